@@ -1,27 +1,345 @@
 #include "base64.hpp"
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/insert_linebreaks.hpp>
-#include <boost/archive/iterators/remove_whitespace.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
-
-using namespace boost::archive::iterators;
-
-std::string Base64::encode(const std::string &s) {
-  using it_base64_t = insert_linebreaks<
-      base64_from_binary<transform_width<std::string::const_iterator, 6, 8>>,
-      72>;
-  unsigned int writePaddChars = (3 - s.length() % 3) % 3;
-  std::string base64(it_base64_t(s.begin()), it_base64_t(s.end()));
-  base64.append(writePaddChars, '=');
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Decoding table: the 6-bit value of each character, or one of these.
+constexpr std::uint8_t invalid = 0xff;
+constexpr std::uint8_t space = 0xfe;
+constexpr std::uint8_t pad = 0xfd;
+
+struct DecodeTable {
+  std::uint8_t value[256];
+
+  constexpr DecodeTable() : value() {
+    for (auto &v : value)
+      v = invalid;
+    for (int i = 0; i < 64; ++i)
+      value[static_cast<unsigned char>(alphabet[i])] = static_cast<std::uint8_t>(i);
+    for (char c : {' ', '\t', '\r', '\n', '\v', '\f'})
+      value[static_cast<unsigned char>(c)] = space;
+    value[static_cast<unsigned char>('=')] = pad;
+  }
+};
+
+constexpr DecodeTable decode_table;
+
+// A kernel converts as many whole blocks as it can from the front of the
+// input and returns how much input it consumed; the scalar code finishes
+// the rest. Encode kernels consume multiples of 3 bytes and write 4 chars
+// per 3 bytes. Decode kernels stop at the first block that is not pure
+// alphabet (whitespace, padding or garbage) and write 3 bytes per 4 chars,
+// but may store up to 8 bytes past that.
+using encode_kernel = std::size_t (*)(const unsigned char *in, std::size_t n,
+                                      char *out);
+using decode_kernel = std::size_t (*)(const char *in, std::size_t n,
+                                      unsigned char *out);
+
+std::size_t encode_none(const unsigned char *, std::size_t, char *) {
+  return 0;
+}
+std::size_t decode_none(const char *, std::size_t, unsigned char *) {
+  return 0;
+}
+
+#ifdef BASE64_X86
+
+// Encoding after Wojciech Muła's pshufb method: spread 12 bytes over 16
+// lanes, cut out the 6-bit fields with two multiplies and map them to ASCII
+// with one table lookup of per-range offsets.
+__attribute__((target("ssse3"))) inline __m128i
+encode_lookup(__m128i indices) {
+  // 0..25 -> 13 ('A'), 26..51 -> 0 ('a' - 26), 52..61 -> 1..10 ('0' - 52),
+  // 62 -> 11 ('+' - 62), 63 -> 12 ('/' - 63).
+  __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  __m128i below_26 = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  range = _mm_or_si128(range, _mm_and_si128(below_26, _mm_set1_epi8(13)));
+  const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+__attribute__((target("ssse3"))) inline __m128i encode_split(__m128i in) {
+  in = _mm_shuffle_epi8(
+      in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i ac = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                               _mm_set1_epi32(0x04000040));
+  __m128i bd = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                               _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(ac, bd);
+}
+
+__attribute__((target("ssse3"))) std::size_t
+encode_ssse3(const unsigned char *in, std::size_t n, char *out) {
+  std::size_t i = 0;
+  // Each step reads 16 bytes but only uses 12.
+  for (; i + 16 <= n; i += 12, out += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     encode_lookup(encode_split(block)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) std::size_t
+encode_avx2(const unsigned char *in, std::size_t n, char *out) {
+  std::size_t i = 0;
+  const __m256i shuffle = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5,
+      4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i offsets = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  // 24 bytes per step, 12 per 128-bit lane; the upper load reads 4 bytes
+  // past them.
+  for (; i + 28 <= n; i += 24, out += 32) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 12));
+    __m256i block =
+        _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    block = _mm256_shuffle_epi8(block, shuffle);
+    __m256i ac = _mm256_mulhi_epu16(
+        _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00)),
+        _mm256_set1_epi32(0x04000040));
+    __m256i bd = _mm256_mullo_epi16(
+        _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0)),
+        _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(ac, bd);
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i below_26 = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range,
+                            _mm256_and_si256(below_26, _mm256_set1_epi8(13)));
+    __m256i chars =
+        _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), chars);
+  }
+  return i;
+}
+
+// Decoding: map each character to its 6-bit value with range compares
+// (characters >= 0x80 compare as negative and match no range), then pack
+// four values into three bytes with two multiply-adds.
+__attribute__((target("ssse3"))) inline __m128i in_range(__m128i c, char lo,
+                                                         char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                       _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), c));
+}
+
+__attribute__((target("avx2"))) inline __m256i in_range(__m256i c, char lo,
+                                                        char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+__attribute__((target("ssse3"))) inline bool decode_values(__m128i c,
+                                                           __m128i &values) {
+  __m128i upper = in_range(c, 'A', 'Z');
+  __m128i lower = in_range(c, 'a', 'z');
+  __m128i digit = in_range(c, '0', '9');
+  __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+  __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+  __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                               _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+  if (_mm_movemask_epi8(valid) != 0xffff)
+    return false;
+  __m128i shift = _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                   _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+      _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                   _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62 - '+')),
+                                _mm_and_si128(slash,
+                                              _mm_set1_epi8(63 - '/')))));
+  values = _mm_add_epi8(c, shift);
+  return true;
+}
+
+__attribute__((target("ssse3"))) inline __m128i decode_pack(__m128i values) {
+  // aaaaaa bbbbbb -> 12-bit pairs, then pairs -> 24 bits per 32-bit lane.
+  __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                               13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3"))) std::size_t
+decode_ssse3(const char *in, std::size_t n, unsigned char *out) {
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16, out += 12) {
+    __m128i values;
+    if (!decode_values(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)),
+            values))
+      break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), decode_pack(values));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) std::size_t
+decode_avx2(const char *in, std::size_t n, unsigned char *out) {
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4,
+      10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32, out += 24) {
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    __m256i upper = in_range(c, 'A', 'Z');
+    __m256i lower = in_range(c, 'a', 'z');
+    __m256i digit = in_range(c, '0', '9');
+    __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+    __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+    __m256i valid =
+        _mm256_or_si256(_mm256_or_si256(upper, lower),
+                        _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+    if (_mm256_movemask_epi8(valid) != -1)
+      break;
+    __m256i shift = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                        _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+        _mm256_or_si256(
+            _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+            _mm256_or_si256(
+                _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')),
+                _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')))));
+    __m256i values = _mm256_add_epi8(c, shift);
+    __m256i pairs =
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    __m256i bytes = _mm256_shuffle_epi8(words, pack);
+    // 12 bytes at the bottom of each lane; close the gap between them.
+    bytes = _mm256_permutevar8x32_epi32(
+        bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), bytes);
+  }
+  return i;
+}
+
+#endif // BASE64_X86
+
+struct Kernels {
+  encode_kernel encode;
+  decode_kernel decode;
+};
+
+bool cpu_supports(Base64::Kernel kernel) {
+#ifdef BASE64_X86
+  __builtin_cpu_init();
+  if (kernel == Base64::Kernel::avx2)
+    return __builtin_cpu_supports("avx2");
+  if (kernel == Base64::Kernel::ssse3)
+    return __builtin_cpu_supports("ssse3");
+#endif
+  return kernel == Base64::Kernel::scalar;
+}
+
+const Kernels &kernels(Base64::Kernel kernel) {
+  static const Kernels scalar{encode_none, decode_none};
+#ifdef BASE64_X86
+  static const Kernels ssse3{encode_ssse3, decode_ssse3};
+  static const Kernels avx2{encode_avx2, decode_avx2};
+  static const Kernels &best = cpu_supports(Base64::Kernel::avx2)    ? avx2
+                               : cpu_supports(Base64::Kernel::ssse3) ? ssse3
+                                                                     : scalar;
+#else
+  static const Kernels &best = scalar;
+#endif
+  if (kernel == Base64::Kernel::best)
+    return best;
+  if (!cpu_supports(kernel))
+    throw std::invalid_argument("Base64 kernel not supported on this CPU");
+#ifdef BASE64_X86
+  if (kernel == Base64::Kernel::avx2)
+    return avx2;
+  if (kernel == Base64::Kernel::ssse3)
+    return ssse3;
+#endif
+  return scalar;
+}
+
+// Room a decode kernel may write past the bytes it produces.
+constexpr std::size_t decode_slack = 8;
+
+} // namespace
+
+bool Base64::supported(Kernel kernel) {
+  return kernel == Kernel::best || cpu_supports(kernel);
+}
+
+std::string Base64::encode(std::string_view data, Kernel kernel) {
+  auto in = reinterpret_cast<const unsigned char *>(data.data());
+  std::size_t n = data.size();
+  std::string base64((n + 2) / 3 * 4, '\0');
+  char *out = base64.data();
+
+  std::size_t i = kernels(kernel).encode(in, n, out);
+  out += i / 3 * 4;
+  for (; i + 3 <= n; i += 3, out += 4) {
+    std::uint32_t bits = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+    out[0] = alphabet[bits >> 18];
+    out[1] = alphabet[bits >> 12 & 0x3f];
+    out[2] = alphabet[bits >> 6 & 0x3f];
+    out[3] = alphabet[bits & 0x3f];
+  }
+  if (i < n) {
+    std::uint32_t bits = in[i] << 16 | (i + 1 < n ? in[i + 1] << 8 : 0);
+    out[0] = alphabet[bits >> 18];
+    out[1] = alphabet[bits >> 12 & 0x3f];
+    out[2] = i + 1 < n ? alphabet[bits >> 6 & 0x3f] : '=';
+    out[3] = '=';
+  }
   return base64;
 }
 
-std::string Base64::decode(const std::string &base64) {
-  using it_binary_t = transform_width<
-      binary_from_base64<remove_whitespace<std::string::const_iterator>>, 8, 6>;
-  unsigned int paddChars = std::count(base64.begin(), base64.end(), '=');
-  std::string result(it_binary_t(base64.begin()), it_binary_t(base64.end()));
-  result.erase(result.end() - paddChars, result.end());
+std::string Base64::decode(std::string_view base64) {
+  std::string result;
+  decode(base64, result);
   return result;
 }
+
+void Base64::decode(std::string_view base64, std::string &out,
+                    Kernel kernel) {
+  const char *in = base64.data();
+  std::size_t n = base64.size();
+  out.resize(n / 4 * 3 + 3 + decode_slack);
+  auto dst = reinterpret_cast<unsigned char *>(out.data());
+
+  std::size_t i = kernels(kernel).decode(in, n, dst);
+  dst += i / 4 * 3;
+
+  // Whatever the kernel left: the tail, and anything with whitespace or
+  // padding in it.
+  std::uint32_t bits = 0;
+  int pending = 0; // bits held in `bits`
+  bool padded = false;
+  for (; i < n; ++i) {
+    std::uint8_t value = decode_table.value[static_cast<unsigned char>(in[i])];
+    if (value < 64 && !padded) {
+      bits = bits << 6 | value;
+      pending += 6;
+      if (pending >= 8) {
+        pending -= 8;
+        *dst++ = static_cast<unsigned char>(bits >> pending);
+      }
+    } else if (value == pad) {
+      padded = true;
+    } else if (value != space) {
+      throw std::invalid_argument("Invalid Base64 input");
+    }
+  }
+  out.resize(dst - reinterpret_cast<unsigned char *>(out.data()));
+}
@@ -2,11 +2,27 @@
 #define BASE64_HPP
 
 #include <string>
+#include <string_view>
 
+// Standard Base64 ('+', '/', '=' padding) without line breaks. Long inputs
+// go through SSSE3 or AVX2 kernels when the CPU has them; the choice is made
+// once at startup.
 class Base64 {
 public:
-  static std::string encode(const std::string &s);
-  static std::string decode(const std::string &base64);
+  // The code paths encode and decode can take. best is the one picked for
+  // this CPU; the others are there so tests can hold each to the scalar one.
+  enum class Kernel { best, scalar, ssse3, avx2 };
+  static bool supported(Kernel kernel);
+
+  static std::string encode(std::string_view data,
+                            Kernel kernel = Kernel::best);
+
+  // Whitespace is skipped and missing padding tolerated. Throws
+  // std::invalid_argument on any other character outside the alphabet.
+  static std::string decode(std::string_view base64);
+  // Same, writing into out so that its capacity is reused.
+  static void decode(std::string_view base64, std::string &out,
+                     Kernel kernel = Kernel::best);
 };
 
 #endif // BASE64_HPP
@@ -0,0 +1,184 @@
+// Holds each SIMD Base64 kernel this CPU has to the scalar code: random
+// inputs of every length up to 256 bytes and some large ones, encoded and
+// decoded both ways, with padding dropped, whitespace inserted and invalid
+// characters that both must reject. Then holds the codec to the
+// boost::archive chain it replaced, which wrote the Base64 already stored.
+#include "base64.hpp"
+#include <algorithm>
+#include <boost/archive/iterators/base64_from_binary.hpp>
+#include <boost/archive/iterators/binary_from_base64.hpp>
+#include <boost/archive/iterators/insert_linebreaks.hpp>
+#include <boost/archive/iterators/remove_whitespace.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+using Kernel = Base64::Kernel;
+
+std::mt19937_64 rng(12345);
+int failures = 0;
+
+void fail(const char *kernel, const char *what, std::size_t length) {
+  if (++failures <= 20)
+    std::cerr << kernel << ": " << what << " differs at length " << length
+              << '\n';
+}
+
+std::string random_bytes(std::size_t n) {
+  std::string bytes(n, '\0');
+  for (auto &c : bytes)
+    c = static_cast<char>(rng());
+  return bytes;
+}
+
+// The decoded bytes, or "!" if decoding threw.
+std::string decode(std::string_view base64, Kernel kernel) {
+  std::string out;
+  try {
+    Base64::decode(base64, out, kernel);
+  } catch (const std::invalid_argument &) {
+    return "!";
+  }
+  return out;
+}
+
+void check(const char *name, Kernel kernel, const std::string &data) {
+  auto n = data.size();
+  auto encoded = Base64::encode(data, Kernel::scalar);
+  if (Base64::encode(data, kernel) != encoded)
+    fail(name, "encode", n);
+  if (decode(encoded, kernel) != data ||
+      decode(encoded, Kernel::scalar) != data)
+    fail(name, "decode", n);
+
+  auto unpadded = encoded.substr(0, encoded.find('='));
+  if (decode(unpadded, kernel) != data)
+    fail(name, "decode without padding", n);
+
+  // Line breaks and spaces anywhere, as MIME and hand-wrapped input have.
+  auto spaced = encoded;
+  for (int i = 0; i < 3 && !spaced.empty(); ++i)
+    spaced.insert(rng() % (spaced.size() + 1), rng() % 2 ? "\r\n" : " ");
+  if (decode(spaced, kernel) != data)
+    fail(name, "decode with whitespace", n);
+
+  // One invalid character; every kernel must reject it wherever it is.
+  static const char bad[] = {'!', '-', '_', '.', '\0', '\x80', '\xff', '@'};
+  auto garbled = encoded;
+  garbled.insert(rng() % (garbled.size() + 1), 1, bad[rng() % sizeof bad]);
+  if (decode(garbled, kernel) != "!" || decode(garbled, Kernel::scalar) != "!")
+    fail(name, "rejection of invalid input", n);
+
+  // Arbitrary text: the kernel must agree with the scalar code whether that
+  // decodes it or throws.
+  auto noise = random_bytes(n);
+  for (auto &c : noise)
+    if (rng() % 4)
+      c = "ABCXYZabcxyz019+/=\n"[rng() % 19];
+  if (decode(noise, kernel) != decode(noise, Kernel::scalar))
+    fail(name, "decode of arbitrary input", n);
+}
+
+// The old Base64::encode and decode, as they were, but for decode giving
+// "!" where it threw. encode broke lines every 72 characters; decode skipped
+// whitespace and took values with or without padding.
+std::string legacy_encode(const std::string &s) {
+  using namespace boost::archive::iterators;
+  using it_base64_t = insert_linebreaks<
+      base64_from_binary<transform_width<std::string::const_iterator, 6, 8>>,
+      72>;
+  unsigned int writePaddChars = (3 - s.length() % 3) % 3;
+  std::string base64(it_base64_t(s.begin()), it_base64_t(s.end()));
+  base64.append(writePaddChars, '=');
+  return base64;
+}
+
+std::string legacy_decode(const std::string &base64) {
+  using namespace boost::archive::iterators;
+  using it_binary_t = transform_width<
+      binary_from_base64<remove_whitespace<std::string::const_iterator>>, 8, 6>;
+  unsigned int paddChars = std::count(base64.begin(), base64.end(), '=');
+  try {
+    std::string result(it_binary_t(base64.begin()), it_binary_t(base64.end()));
+    result.erase(result.end() - paddChars, result.end());
+    return result;
+  } catch (const std::exception &) {
+    return "!";
+  }
+}
+
+// The codec must read what the old one stored, line breaks and all, with or
+// without its padding; and write the same apart from the line breaks, which
+// the old decoder still reads.
+void check_legacy(Kernel kernel, const std::string &data) {
+  auto n = data.size();
+  auto legacy = legacy_encode(data);
+  auto unbroken = legacy;
+  unbroken.erase(std::remove(unbroken.begin(), unbroken.end(), '\n'),
+                 unbroken.end());
+  if (Base64::encode(data, kernel) != unbroken)
+    fail("legacy", "encode", n);
+  if (decode(legacy, kernel) != data)
+    fail("legacy", "decode of a stored value", n);
+  auto unpadded = legacy.substr(0, legacy.find('='));
+  if (decode(unpadded, kernel) != data || legacy_decode(unpadded) != data)
+    fail("legacy", "decode of a stored value without padding", n);
+  if (legacy_decode(Base64::encode(data, kernel)) != data)
+    fail("legacy", "old decode of a new value", n);
+}
+
+} // namespace
+
+int main() {
+  const std::pair<const char *, Kernel> kernels[] = {
+      {"best", Kernel::best}, {"ssse3", Kernel::ssse3}, {"avx2", Kernel::avx2}};
+  for (auto [name, kernel] : kernels) {
+    if (!Base64::supported(kernel)) {
+      std::cout << name << ": not supported on this CPU, skipped\n";
+      continue;
+    }
+    for (std::size_t n = 0; n <= 256; ++n)
+      for (int round = 0; round < 20; ++round)
+        check(name, kernel, random_bytes(n));
+    for (std::size_t n : {4095, 4096, 65537, 1 << 20})
+      check(name, kernel, random_bytes(n));
+    std::cout << name << ": checked\n";
+  }
+
+  // Values as the old encoder wrote them: RFC 4648's test vectors, and a
+  // line break after 72 characters.
+  const std::pair<std::string, std::string> stored[] = {
+      {"", ""},
+      {"f", "Zg=="},
+      {"fo", "Zm8="},
+      {"foo", "Zm9v"},
+      {"foob", "Zm9vYg=="},
+      {"fooba", "Zm9vYmE="},
+      {"foobar", "Zm9vYmFy"},
+      {std::string(60, 'a'),
+       "YWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFhYWFh"
+       "YWFh\nYWFhYWFh"}};
+  for (const auto &[data, base64] : stored) {
+    if (legacy_encode(data) != base64 || decode(base64, Kernel::best) != data)
+      fail("legacy", "stored value", data.size());
+  }
+  for (auto kernel : {Kernel::scalar, Kernel::best}) {
+    for (std::size_t n = 0; n <= 256; ++n)
+      for (int round = 0; round < 20; ++round)
+        check_legacy(kernel, random_bytes(n));
+    for (std::size_t n : {4095, 65537})
+      check_legacy(kernel, random_bytes(n));
+  }
+  std::cout << "legacy: checked\n";
+
+  if (failures) {
+    std::cerr << failures << " mismatches\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,729 @@
+// Load generator for the server. It starts a server on a temporary database
+// (or targets one that is already running), drives it with scripted clients
+// and reports throughput and latency percentiles per route. See usage() for
+// the options; `meson test --benchmark` runs it against the freshly built
+// server.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = net::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+// What a scripted client does; each is reported as its own route.
+enum class Action {
+  login,
+  ping,
+  poll_chat,
+  post_chat,
+  list_docs,
+  open_doc,
+  save_doc,
+  count
+};
+
+constexpr std::size_t action_count = static_cast<std::size_t>(Action::count);
+
+const char *action_routes[action_count] = {
+    "POST /login", "POST /ping",     "GET /chat", "POST /chat",
+    "GET /docs",   "GET /docs/{id}", "POST /docs"};
+// Names accepted by --mix.
+const char *action_names[action_count] = {"login", "ping", "poll", "post",
+                                          "list",  "open", "save"};
+
+enum class LoopMode {
+  closed, // every client sends its next request once the last one returned
+  open    // requests arrive at a fixed rate whether or not earlier ones
+          // have returned, and their latency counts from the arrival
+};
+
+struct BenchOptions {
+  std::string server;                   // binary to launch
+  std::vector<std::string> server_args; // extra arguments for it
+  std::string target; // host:port of a running server, instead of launching
+  LoopMode mode = LoopMode::closed;
+  unsigned int users = 32;
+  unsigned int workspaces = 4;
+  double duration = 10;      // seconds measured
+  double warmup = 2;         // seconds run before measuring
+  double rate = 1000;        // requests per second, open loop
+  unsigned int think_ms = 0; // pause between requests, closed loop
+  double ping_interval = 5;  // seconds between a client's pings
+  bool etags = true; // polls send back the ETag of what they last got
+  // Relative weights of the non-ping actions.
+  std::array<unsigned int, action_count> mix = {0, 0, 50, 15, 15, 10, 10};
+  double max_p99_ms = 0; // fail when a route's p99 is above it; 0 disables
+  std::uint64_t seed = 1;
+};
+
+void usage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " (--server=PATH | --target=HOST:PORT) "
+      << "[options]\n"
+         "  --server=PATH             start this server binary on a "
+         "temporary database\n"
+         "  --server-arg=ARG          pass ARG to it (repeatable)\n"
+         "  --target=HOST:PORT        use a running server instead\n"
+         "  --mode=closed|open        closed loop, or open loop at --rate "
+         "(default closed)\n"
+         "  --users=N                 concurrent clients (default 32)\n"
+         "  --workspaces=N            workspaces they are spread over "
+         "(default 4)\n"
+         "  --duration=S              seconds measured (default 10)\n"
+         "  --warmup=S                seconds run first, not measured "
+         "(default 2)\n"
+         "  --rate=R                  open loop: requests per second "
+         "(default 1000)\n"
+         "  --think-ms=MS             closed loop: pause between a "
+         "client's requests (default 0)\n"
+         "  --ping-interval=S         seconds between a client's pings "
+         "(default 5)\n"
+         "  --etags=on|off            conditional polls with If-None-Match "
+         "(default on)\n"
+         "  --mix=NAME:W,...          weights of poll, post, list, open "
+         "and save (default poll:50,post:15,list:15,open:10,save:10)\n"
+         "  --max-p99-ms=MS           exit with failure if any route's p99 "
+         "is higher\n"
+         "  --seed=N                  random seed (default 1)\n";
+}
+
+bool split_flag(const std::string &arg, std::string &key, std::string &value) {
+  if (arg.rfind("--", 0) != 0)
+    return false;
+  auto eq = arg.find('=');
+  if (eq == std::string::npos)
+    return false;
+  key = arg.substr(2, eq - 2);
+  value = arg.substr(eq + 1);
+  return true;
+}
+
+std::array<unsigned int, action_count> parse_mix(const std::string &value) {
+  std::array<unsigned int, action_count> mix{};
+  std::size_t start = 0;
+  while (start < value.size()) {
+    auto end = value.find(',', start);
+    if (end == std::string::npos)
+      end = value.size();
+    auto item = value.substr(start, end - start);
+    auto colon = item.find(':');
+    if (colon == std::string::npos)
+      throw std::invalid_argument("Bad --mix entry: " + item);
+    auto name = item.substr(0, colon);
+    auto found = std::find(std::begin(action_names), std::end(action_names),
+                           name);
+    auto action = static_cast<std::size_t>(found - std::begin(action_names));
+    // Every client logs in once and pings on its own schedule.
+    if (found == std::end(action_names) ||
+        action == static_cast<std::size_t>(Action::login) ||
+        action == static_cast<std::size_t>(Action::ping))
+      throw std::invalid_argument("Unknown --mix action: " + name);
+    mix[action] = static_cast<unsigned int>(std::stoul(item.substr(colon + 1)));
+    start = end + 1;
+  }
+  return mix;
+}
+
+BenchOptions parse_options(int argc, char *argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string key, value;
+    if (!split_flag(argv[i], key, value))
+      throw std::invalid_argument(std::string("Unexpected argument: ") +
+                                  argv[i]);
+    if (key == "server")
+      options.server = value;
+    else if (key == "server-arg")
+      options.server_args.push_back(value);
+    else if (key == "target")
+      options.target = value;
+    else if (key == "mode" && (value == "closed" || value == "open"))
+      options.mode = value == "open" ? LoopMode::open : LoopMode::closed;
+    else if (key == "users")
+      options.users = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "workspaces")
+      options.workspaces = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "duration")
+      options.duration = std::stod(value);
+    else if (key == "warmup")
+      options.warmup = std::stod(value);
+    else if (key == "rate")
+      options.rate = std::stod(value);
+    else if (key == "think-ms")
+      options.think_ms = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "ping-interval")
+      options.ping_interval = std::stod(value);
+    else if (key == "etags" && (value == "on" || value == "off"))
+      options.etags = value == "on";
+    else if (key == "mix")
+      options.mix = parse_mix(value);
+    else if (key == "max-p99-ms")
+      options.max_p99_ms = std::stod(value);
+    else if (key == "seed")
+      options.seed = std::stoull(value);
+    else
+      throw std::invalid_argument("Unknown option: " + std::string(argv[i]));
+  }
+  if (options.server.empty() == options.target.empty())
+    throw std::invalid_argument("Pass exactly one of --server and --target");
+  if (options.users == 0 || options.workspaces == 0)
+    throw std::invalid_argument("--users and --workspaces must be positive");
+  if (options.mode == LoopMode::open && options.rate <= 0)
+    throw std::invalid_argument("--rate must be positive");
+  unsigned int total = 0;
+  for (auto weight : options.mix)
+    total += weight;
+  if (total == 0)
+    throw std::invalid_argument("--mix has no actions");
+  return options;
+}
+
+// Latencies in nanoseconds and failure counts per action, recorded by one
+// client thread and merged at the end.
+struct Samples {
+  std::array<std::vector<std::uint64_t>, action_count> latencies;
+  std::array<std::uint64_t, action_count> errors{};
+
+  void merge(const Samples &other) {
+    for (std::size_t a = 0; a < action_count; ++a) {
+      latencies[a].insert(latencies[a].end(), other.latencies[a].begin(),
+                          other.latencies[a].end());
+      errors[a] += other.errors[a];
+    }
+  }
+};
+
+// When measuring starts and stops. Requests that started before measure_from
+// are warmup and not recorded, except logins, which only happen once.
+struct Window {
+  clock_type::time_point measure_from;
+  clock_type::time_point end;
+};
+
+// Text after "key": in a JSON body, for the few fields the script follows.
+std::int64_t find_number(const std::string &body, const std::string &key) {
+  auto at = body.find("\"" + key + "\":");
+  if (at == std::string::npos)
+    return -1;
+  return std::strtoll(body.c_str() + at + key.size() + 3, nullptr, 10);
+}
+
+void find_doc_ids(const std::string &body, std::vector<std::string> &ids) {
+  ids.clear();
+  const std::string key = "\"id\":\"";
+  for (auto at = body.find(key); at != std::string::npos;
+       at = body.find(key, at)) {
+    at += key.size();
+    auto end = body.find('"', at);
+    if (end == std::string::npos)
+      break;
+    ids.push_back(body.substr(at, end - at));
+  }
+}
+
+// One scripted client: a keep-alive connection, a session and the state it
+// needs to make follow-up requests (chat cursor, known docs).
+class Client {
+public:
+  Client(const BenchOptions &options, const tcp::endpoint &endpoint,
+         unsigned int index)
+      : options(options), endpoint(endpoint), index(index),
+        random(options.seed * 7919 + index),
+        workspace("bench-" + std::to_string(index % options.workspaces)),
+        user("user-" + std::to_string(index)) {
+    for (auto weight : options.mix)
+      mix_total += weight;
+  }
+
+  bool login(Samples &samples) {
+    auto started = clock_type::now();
+    auto status = send(http::verb::post, "/login",
+                       "{\"id\":\"" + workspace + "\",\"password\":\"bench\"}",
+                       "application/json");
+    bool ok = status == 200 && !body.empty();
+    record(samples, Action::login, started, ok, true);
+    if (ok)
+      token = body;
+    next_ping = clock_type::now();
+    return ok;
+  }
+
+  // Make the client's next request. started is when it was due, which in
+  // the open loop may be well before now.
+  void step(Samples &samples, const Window &window,
+            clock_type::time_point started) {
+    this->window = &window;
+    if (clock_type::now() >= next_ping) {
+      next_ping += std::chrono::duration_cast<clock_type::duration>(
+          std::chrono::duration<double>(options.ping_interval));
+      record(samples, Action::ping, started,
+             send(http::verb::post, "/ping", user, "text/plain") == 200);
+      return;
+    }
+    auto action = pick();
+    if ((action == Action::open_doc || action == Action::save_doc) &&
+        docs.empty() && !listed)
+      action = Action::list_docs;
+    switch (action) {
+    case Action::poll_chat: {
+      auto target = last_id < 0 ? std::string("/chat?limit=50")
+                                : "/chat?since_id=" + std::to_string(last_id);
+      if (target != poll_target) {
+        poll_target = target;
+        poll_etag.clear();
+      }
+      auto status = send(http::verb::get, target, {}, nullptr, &poll_etag);
+      if (status == 200)
+        last_id = find_number(body, "last_id");
+      record(samples, action, started, status == 200 || status == 304);
+      break;
+    }
+    case Action::post_chat:
+      record(samples, action, started,
+             send(http::verb::post, "/chat",
+                  "message " + std::to_string(++posted) + " from " + user,
+                  "text/plain") == 200);
+      break;
+    case Action::list_docs: {
+      bool ok = send(http::verb::get, "/docs", {}, nullptr) == 200;
+      if (ok) {
+        find_doc_ids(body, docs);
+        listed = true;
+      }
+      record(samples, action, started, ok);
+      break;
+    }
+    case Action::open_doc: {
+      if (docs.empty()) { // nothing to open yet; create one instead
+        save(samples, started, true);
+        break;
+      }
+      const auto &id = pick_doc();
+      auto status =
+          send(http::verb::get, "/docs/" + id, {}, nullptr, &doc_etags[id]);
+      record(samples, action, started, status == 200 || status == 304);
+      break;
+    }
+    default:
+      save(samples, started, docs.empty() || random() % 4 == 0);
+      break;
+    }
+  }
+
+private:
+  Action pick() {
+    auto roll = static_cast<unsigned int>(random() % mix_total);
+    for (std::size_t a = 0; a < action_count; ++a) {
+      if (roll < options.mix[a])
+        return static_cast<Action>(a);
+      roll -= options.mix[a];
+    }
+    return Action::poll_chat;
+  }
+
+  const std::string &pick_doc() { return docs[random() % docs.size()]; }
+
+  // Create a doc or update one of the known ones, with a body of a few KB as
+  // a typical note would have.
+  void save(Samples &samples, clock_type::time_point started, bool create) {
+    std::string content(1024 + random() % 4096, 'x');
+    auto title = "note " + std::to_string(++saved) + " by " + user;
+    auto json = "{\"date\":\"2024-01-01\",\"title\":\"" + title +
+                "\",\"content\":\"" + content + "\"}";
+    auto target = create ? std::string("/docs") : "/docs/" + pick_doc();
+    record(samples, Action::save_doc, started,
+           send(http::verb::post, target, json, "application/json") == 200);
+  }
+
+  void record(Samples &samples, Action action, clock_type::time_point started,
+              bool ok, bool always = false) {
+    auto a = static_cast<std::size_t>(action);
+    if (!always && (started < window->measure_from || started >= window->end))
+      return;
+    if (!ok) {
+      ++samples.errors[a];
+      return;
+    }
+    samples.latencies[a].push_back(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now() - started)
+            .count()));
+  }
+
+  // One request on the keep-alive connection, reconnecting when needed.
+  // Returns the status, or 0 if the exchange failed; the body is left in
+  // body.
+  // With an etag, a GET is made conditional on it, and the etag set to that
+  // of the response.
+  unsigned int send(http::verb method, const std::string &target,
+                    std::string request_body, const char *content_type,
+                    std::string *etag = nullptr) {
+    beast::error_code ec;
+    if (!socket.is_open()) {
+      socket.connect(endpoint, ec);
+      if (ec) {
+        socket.close(ec);
+        return 0;
+      }
+      socket.set_option(tcp::no_delay(true), ec);
+      buffer.clear();
+    }
+    http::request<http::string_body> request{method, target, 11};
+    request.set(http::field::host, "localhost");
+    if (!token.empty())
+      request.set(http::field::authorization, "Bearer " + token);
+    if (content_type)
+      request.set(http::field::content_type, content_type);
+    if (etag && options.etags && !etag->empty())
+      request.set(http::field::if_none_match, *etag);
+    request.body() = std::move(request_body);
+    request.prepare_payload();
+
+    http::response<http::string_body> response;
+    http::write(socket, request, ec);
+    if (!ec)
+      http::read(socket, buffer, response, ec);
+    if (ec) {
+      socket.close(ec);
+      body.clear();
+      return 0;
+    }
+    if (!response.keep_alive())
+      socket.close(ec);
+    if (etag && response.result() != http::status::not_modified) {
+      auto found = response.find(http::field::etag);
+      if (found == response.end())
+        etag->clear();
+      else
+        etag->assign(found->value().data(), found->value().size());
+    }
+    body = std::move(response.body());
+    return response.result_int();
+  }
+
+  const BenchOptions &options;
+  const tcp::endpoint endpoint;
+  const unsigned int index;
+  std::mt19937_64 random;
+  const std::string workspace;
+  const std::string user;
+  unsigned int mix_total = 0;
+  const Window *window = nullptr;
+
+  net::io_context ioc;
+  tcp::socket socket{ioc};
+  beast::flat_buffer buffer;
+  std::string body; // of the last response
+  std::string token;
+
+  clock_type::time_point next_ping;
+  std::int64_t last_id = -1;
+  std::string poll_target, poll_etag; // of the last chat poll
+  std::vector<std::string> docs;
+  std::unordered_map<std::string, std::string> doc_etags;
+  bool listed = false;
+  unsigned int posted = 0;
+  unsigned int saved = 0;
+};
+
+// Open loop: arrival times, Poisson distributed at the target rate, handed
+// to whichever client is free.
+class Arrivals {
+public:
+  void push(clock_type::time_point due) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(due);
+    }
+    ready.notify_one();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    ready.notify_all();
+  }
+
+  bool pop(clock_type::time_point &due) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] { return closed || !queue.empty(); });
+    if (queue.empty())
+      return false;
+    due = queue.front();
+    queue.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<clock_type::time_point> queue;
+  bool closed = false;
+};
+
+// A server child process on a temporary database, stopped when destroyed.
+class LaunchedServer {
+public:
+  LaunchedServer(const BenchOptions &options, unsigned short port) {
+    char pattern[] = "/tmp/collabchat-bench-XXXXXX";
+    if (!mkdtemp(pattern))
+      throw std::runtime_error("Cannot create a temporary directory");
+    directory = pattern;
+
+    std::vector<std::string> args = {options.server, "127.0.0.1",
+                                     std::to_string(port),
+                                     "--db=" + directory + "/bench.db",
+                                     "--log-level=warning"};
+    args.insert(args.end(), options.server_args.begin(),
+                options.server_args.end());
+    std::vector<char *> argv;
+    for (auto &arg : args)
+      argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    pid = fork();
+    if (pid < 0)
+      throw std::runtime_error("fork failed");
+    if (pid == 0) {
+      execv(argv[0], argv.data());
+      std::perror(argv[0]);
+      _exit(127);
+    }
+  }
+
+  ~LaunchedServer() {
+    if (pid > 0) {
+      kill(pid, SIGTERM);
+      waitpid(pid, nullptr, 0);
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+  }
+
+  // Wait until the server accepts connections; throws if it exits first or
+  // takes longer than ten seconds.
+  void wait_ready(const tcp::endpoint &endpoint) {
+    net::io_context ioc;
+    auto deadline = clock_type::now() + std::chrono::seconds(10);
+    while (clock_type::now() < deadline) {
+      if (waitpid(pid, nullptr, WNOHANG) == pid) {
+        pid = -1;
+        throw std::runtime_error("Server exited during startup");
+      }
+      tcp::socket socket(ioc);
+      beast::error_code ec;
+      socket.connect(endpoint, ec);
+      if (!ec)
+        return;
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    throw std::runtime_error("Server did not start listening");
+  }
+
+private:
+  std::string directory;
+  pid_t pid = -1;
+};
+
+unsigned short free_port() {
+  net::io_context ioc;
+  tcp::acceptor acceptor(ioc, {net::ip::make_address("127.0.0.1"), 0});
+  return acceptor.local_endpoint().port();
+}
+
+tcp::endpoint resolve(const std::string &target) {
+  auto colon = target.rfind(':');
+  if (colon == std::string::npos)
+    throw std::invalid_argument("--target must be HOST:PORT");
+  net::io_context ioc;
+  tcp::resolver resolver(ioc);
+  return *resolver
+              .resolve(target.substr(0, colon), target.substr(colon + 1))
+              .begin();
+}
+
+double percentile_ms(const std::vector<std::uint64_t> &sorted, double q) {
+  if (sorted.empty())
+    return 0;
+  auto rank = static_cast<std::size_t>(q * sorted.size());
+  return sorted[std::min(rank, sorted.size() - 1)] / 1e6;
+}
+
+// Print the table; returns false if a route exceeded --max-p99-ms.
+bool report(Samples &samples, const BenchOptions &options) {
+  bool passed = true;
+  std::printf("%-16s %9s %7s %10s %9s %9s %9s %9s\n", "route", "requests",
+              "errors", "req/s", "p50 ms", "p99 ms", "p999 ms", "max ms");
+  std::vector<std::uint64_t> all;
+  std::uint64_t all_errors = 0;
+  auto row = [&](const char *name, std::vector<std::uint64_t> &latencies,
+                 std::uint64_t errors, double seconds) {
+    std::sort(latencies.begin(), latencies.end());
+    char rate[16] = "-";
+    if (seconds > 0)
+      std::snprintf(rate, sizeof rate, "%.1f", latencies.size() / seconds);
+    std::printf("%-16s %9zu %7llu %10s %9.3f %9.3f %9.3f %9.3f\n", name,
+                latencies.size(), static_cast<unsigned long long>(errors),
+                rate, percentile_ms(latencies, 0.50),
+                percentile_ms(latencies, 0.99),
+                percentile_ms(latencies, 0.999),
+                latencies.empty() ? 0.0 : latencies.back() / 1e6);
+  };
+  for (std::size_t a = 0; a < action_count; ++a) {
+    auto &latencies = samples.latencies[a];
+    if (latencies.empty() && !samples.errors[a])
+      continue;
+    // Logins happen once per client, up front; a rate means nothing there.
+    double seconds = a == 0 ? 0 : options.duration;
+    row(action_routes[a], latencies, samples.errors[a], seconds);
+    if (a != 0) {
+      all.insert(all.end(), latencies.begin(), latencies.end());
+      all_errors += samples.errors[a];
+    }
+    if (options.max_p99_ms > 0 &&
+        percentile_ms(latencies, 0.99) > options.max_p99_ms) {
+      std::printf("  p99 above --max-p99-ms=%g\n", options.max_p99_ms);
+      passed = false;
+    }
+  }
+  row("all but login", all, all_errors, options.duration);
+  return passed;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchOptions options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    std::unique_ptr<LaunchedServer> server;
+    tcp::endpoint endpoint;
+    if (!options.server.empty()) {
+      auto port = free_port();
+      endpoint = {net::ip::make_address("127.0.0.1"), port};
+      server = std::make_unique<LaunchedServer>(options, port);
+      server->wait_ready(endpoint);
+    } else {
+      endpoint = resolve(options.target);
+    }
+
+    std::vector<std::unique_ptr<Client>> clients;
+    std::vector<Samples> samples(options.users);
+    for (unsigned int i = 0; i < options.users; ++i)
+      clients.push_back(std::make_unique<Client>(options, endpoint, i));
+
+    auto seconds = [](double s) {
+      return std::chrono::duration_cast<clock_type::duration>(
+          std::chrono::duration<double>(s));
+    };
+    Window window;
+    Arrivals arrivals;
+    std::mutex start_mutex;
+    std::condition_variable started;
+    bool go = false;
+    std::atomic<unsigned int> logged_in{0};
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < options.users; ++i) {
+      threads.emplace_back([&, i] {
+        auto &client = *clients[i];
+        bool ok = client.login(samples[i]);
+        ++logged_in;
+        started.notify_all();
+        {
+          std::unique_lock<std::mutex> lock(start_mutex);
+          started.wait(lock, [&] { return go; });
+        }
+        if (!ok)
+          return;
+        if (options.mode == LoopMode::closed) {
+          for (auto now = clock_type::now(); now < window.end;
+               now = clock_type::now()) {
+            client.step(samples[i], window, now);
+            if (options.think_ms)
+              std::this_thread::sleep_for(
+                  std::chrono::milliseconds(options.think_ms));
+          }
+        } else {
+          clock_type::time_point due;
+          while (arrivals.pop(due))
+            client.step(samples[i], window, due);
+        }
+      });
+    }
+
+    // Everyone logs in first, so the measured mix starts from steady state.
+    {
+      std::unique_lock<std::mutex> lock(start_mutex);
+      started.wait(lock, [&] { return logged_in == options.users; });
+      window.measure_from = clock_type::now() + seconds(options.warmup);
+      window.end = window.measure_from + seconds(options.duration);
+      go = true;
+    }
+    started.notify_all();
+
+    if (options.mode == LoopMode::open) {
+      std::mt19937_64 random(options.seed);
+      std::exponential_distribution<double> gap(options.rate);
+      for (auto due = clock_type::now(); due < window.end;
+           due += seconds(gap(random))) {
+        std::this_thread::sleep_until(due);
+        arrivals.push(due);
+      }
+      arrivals.close();
+    }
+    for (auto &thread : threads)
+      thread.join();
+
+    Samples total;
+    for (auto &s : samples)
+      total.merge(s);
+    std::printf("%s loop, %u clients over %u workspaces, %gs measured after "
+                "%gs warmup\n",
+                options.mode == LoopMode::open ? "Open" : "Closed",
+                options.users, options.workspaces, options.duration,
+                options.warmup);
+    if (options.mode == LoopMode::open)
+      std::printf("Offered load %g req/s\n", options.rate);
+    return report(total, options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
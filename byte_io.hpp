@@ -0,0 +1,73 @@
+#ifndef BYTE_IO_HPP
+#define BYTE_IO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Helpers shared by the binary formats: doc op logs, CRDT state, revision
+// deltas and LZ4 blocks.
+
+// Unsigned LEB128: seven bits per byte, low bits first, the high bit set on
+// every byte but the last.
+inline void put_varint(std::string &out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+// Take a varint off the front of in; false if it is cut off or longer than
+// 64 bits can hold.
+inline bool get_varint(std::string_view &in, std::uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (in.empty())
+      return false;
+    auto byte = static_cast<unsigned char>(in.front());
+    in.remove_prefix(1);
+    value |= std::uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+// Unaligned loads, in the machine's byte order.
+inline std::uint32_t load32(const char *p) {
+  std::uint32_t value;
+  std::memcpy(&value, p, sizeof value);
+  return value;
+}
+
+inline std::uint64_t load64(const char *p) {
+  std::uint64_t value;
+  std::memcpy(&value, p, sizeof value);
+  return value;
+}
+
+// How many bytes from a on equal those from b on, counting up to b_end.
+// Compares eight bytes at a time; in a mismatch the first differing byte is
+// at the lowest set bit of the XOR, as loads are little endian.
+inline std::size_t common_length(const char *a, const char *b,
+                                 const char *b_end) {
+  const char *start = b;
+  while (b_end - b >= 8) {
+    auto diff = load64(a) ^ load64(b);
+    if (diff)
+      return static_cast<std::size_t>(b - start) +
+             static_cast<std::size_t>(__builtin_ctzll(diff)) / 8;
+    a += 8;
+    b += 8;
+  }
+  while (b < b_end && *a == *b) {
+    ++a;
+    ++b;
+  }
+  return static_cast<std::size_t>(b - start);
+}
+
+#endif // BYTE_IO_HPP
@@ -0,0 +1,47 @@
+#include "chat_hub.hpp"
+#include "websocket_session.hpp"
+#include <algorithm>
+
+void ChatHub::join(const std::string &workspace,
+                   const std::shared_ptr<websocket_session> &session) {
+  std::lock_guard<std::mutex> lock(mutex);
+  rooms[workspace].push_back(session);
+}
+
+void ChatHub::leave(const std::string &workspace,
+                    const websocket_session *session) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto room = rooms.find(workspace);
+  if (room == rooms.end())
+    return;
+  auto &members = room->second;
+  members.erase(std::remove_if(members.begin(), members.end(),
+                               [session](const auto &member) {
+                                 auto locked = member.lock();
+                                 return !locked || locked.get() == session;
+                               }),
+                members.end());
+  if (members.empty())
+    rooms.erase(room);
+}
+
+void ChatHub::broadcast(const std::string &workspace, std::string message) {
+  // Collect the recipients first so no session code runs under the lock.
+  std::vector<std::shared_ptr<websocket_session>> recipients;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto room = rooms.find(workspace);
+    if (room == rooms.end())
+      return;
+    recipients.reserve(room->second.size());
+    for (const auto &member : room->second) {
+      if (auto session = member.lock())
+        recipients.push_back(std::move(session));
+    }
+  }
+
+  // One shared copy of the payload for every recipient.
+  auto payload = std::make_shared<const std::string>(std::move(message));
+  for (auto &session : recipients)
+    session->send(payload);
+}
@@ -0,0 +1,31 @@
+#ifndef CHAT_HUB_HPP
+#define CHAT_HUB_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class websocket_session;
+
+// Per-workspace set of subscribed WebSocket sessions. Sessions are held
+// weakly, so a session that goes away without leaving is simply skipped.
+class ChatHub {
+public:
+  void join(const std::string &workspace,
+            const std::shared_ptr<websocket_session> &session);
+  void leave(const std::string &workspace, const websocket_session *session);
+
+  // Push message to every session subscribed to workspace. Safe to call from
+  // any thread; the frames are written on each session's own strand.
+  void broadcast(const std::string &workspace, std::string message);
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string,
+                     std::vector<std::weak_ptr<websocket_session>>>
+      rooms;
+};
+
+#endif // CHAT_HUB_HPP
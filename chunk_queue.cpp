@@ -0,0 +1,73 @@
+#include "chunk_queue.hpp"
+#include <utility>
+
+ChunkQueue::ChunkQueue(std::size_t max_pending) : max_pending(max_pending) {}
+
+bool ChunkQueue::push(std::string &chunk,
+                      std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!space.wait_until(lock, deadline, [this] {
+        return stopped || chunks.size() < max_pending;
+      }) ||
+      stopped)
+    return false;
+  chunks.push_back(std::move(chunk));
+  chunk.clear();
+  if (!spare.empty()) {
+    chunk = std::move(spare.back());
+    spare.pop_back();
+  }
+  return true;
+}
+
+void ChunkQueue::finish(std::string last) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!last.empty())
+    chunks.push_back(std::move(last));
+  finished = true;
+}
+
+bool ChunkQueue::pop(std::string &chunk) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (chunks.empty())
+      return false;
+    chunk = std::move(chunks.front());
+    chunks.pop_front();
+  }
+  space.notify_one();
+  return true;
+}
+
+void ChunkQueue::recycle(std::string buffer) {
+  buffer.clear();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (spare.size() <= max_pending)
+    spare.push_back(std::move(buffer));
+}
+
+bool ChunkQueue::done() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return finished && chunks.empty();
+}
+
+void ChunkQueue::cancel() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    chunks.clear();
+  }
+  space.notify_one();
+}
+
+bool ChunkQueue::cancelled() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stopped;
+}
+
+void ChunkQueue::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  chunks.clear();
+  finished = false;
+  stopped = false;
+}
@@ -0,0 +1,53 @@
+#ifndef CHUNK_QUEUE_HPP
+#define CHUNK_QUEUE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Hands the pieces of a chunked response from a handler running on a DB
+// worker to the connection's strand, which writes them out as they arrive.
+// The producer waits while max_pending chunks are queued, so a slow client
+// holds up its own query instead of the response piling up in memory; the
+// wait is bounded by a deadline so that it cannot hold it up for good.
+// Written chunks' buffers are handed back to the producer for reuse.
+class ChunkQueue {
+public:
+  explicit ChunkQueue(std::size_t max_pending = 4);
+
+  // Producer: queue chunk and leave it holding an empty buffer to fill
+  // next. Returns false, queueing nothing, once the consumer has cancelled
+  // or if there is still no room by deadline.
+  bool push(std::string &chunk, std::chrono::steady_clock::time_point deadline);
+
+  // Queue the rest of the body and mark the end. Never waits.
+  void finish(std::string last);
+
+  // Consumer: take the next chunk, if any.
+  bool pop(std::string &chunk);
+  // Consumer: give back the buffer of a chunk that has been written.
+  void recycle(std::string buffer);
+  // Whether finish() has been called and every chunk taken.
+  bool done() const;
+  // Stop the producer, e.g. because the client went away.
+  void cancel();
+  bool cancelled() const;
+
+  // Ready for the next response.
+  void reset();
+
+private:
+  const std::size_t max_pending;
+  mutable std::mutex mutex;
+  std::condition_variable space;
+  std::deque<std::string> chunks;
+  std::vector<std::string> spare;
+  bool finished = false;
+  bool stopped = false;
+};
+
+#endif // CHUNK_QUEUE_HPP
@@ -0,0 +1,47 @@
+#include "connection.hpp"
+#include "metrics.hpp"
+#include <stdexcept>
+
+static sqlite3 *open_database(const std::string &db_name, int flags) {
+  sqlite3 *db = nullptr;
+  int rc = sqlite3_open_v2(db_name.c_str(), &db, flags, nullptr);
+  if (rc != SQLITE_OK) {
+    metrics::record_sqlite_error(rc);
+    std::string error =
+        "Cannot open database: " + std::string(sqlite3_errmsg(db));
+    sqlite3_close(db);
+    throw std::runtime_error(error);
+  }
+  // Wait for the writer instead of failing immediately with SQLITE_BUSY.
+  sqlite3_busy_timeout(db, 5000);
+  return db;
+}
+
+Connection::Connection(const std::string &db_name, int flags)
+    : db(open_database(db_name, flags)), statements(db) {}
+
+Connection::~Connection() {
+  statements.clear();
+  sqlite3_close(db);
+}
+
+void Connection::sample_page_cache() {
+  int current = 0, highest = 0;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &current, &highest, 0);
+  cache_hits.store(static_cast<std::uint64_t>(current),
+                   std::memory_order_relaxed);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &current, &highest, 0);
+  cache_misses.store(static_cast<std::uint64_t>(current),
+                     std::memory_order_relaxed);
+}
+
+void Connection::execute(const std::string &sql) {
+  char *err_msg = nullptr;
+  int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg);
+  if (rc != SQLITE_OK) {
+    metrics::record_sqlite_error(rc);
+    std::string error = "SQL error: " + std::string(err_msg);
+    sqlite3_free(err_msg);
+    throw std::runtime_error(error);
+  }
+}
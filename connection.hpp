@@ -0,0 +1,51 @@
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include "statement_cache.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+
+// One SQLite connection with its own prepared-statement cache. The connection
+// and its cached statements may only be used by whoever holds mutex. The
+// mutex is recursive so that a write batch can hold the writer while the
+// Database calls inside it lock it again.
+class Connection {
+public:
+  Connection(const std::string &db_name, int flags);
+  ~Connection();
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  sqlite3 *handle() const { return db; }
+
+  // Returns the cached statement for sql, compiling it on first use.
+  Statement prepare(const char *sql) { return statements.prepare(sql); }
+
+  void execute(const std::string &sql);
+
+  const StatementCache &statement_cache() const { return statements; }
+
+  // Copy SQLite's page cache counters to where they can be read without the
+  // lock. Called by whoever holds mutex, as they let go of it.
+  void sample_page_cache();
+  std::uint64_t page_cache_hits() const {
+    return cache_hits.load(std::memory_order_relaxed);
+  }
+  std::uint64_t page_cache_misses() const {
+    return cache_misses.load(std::memory_order_relaxed);
+  }
+
+  std::recursive_mutex mutex;
+
+private:
+  sqlite3 *db = nullptr;
+  StatementCache statements;
+  std::atomic<std::uint64_t> cache_hits{0};
+  std::atomic<std::uint64_t> cache_misses{0};
+};
+
+#endif // CONNECTION_HPP
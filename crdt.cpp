@@ -0,0 +1,331 @@
+#include "crdt.hpp"
+#include "byte_io.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+std::uint64_t get_varint(std::string_view &in) {
+  std::uint64_t value;
+  if (!::get_varint(in, value))
+    throw std::runtime_error("Malformed CRDT data");
+  return value;
+}
+
+std::uint32_t get_client(std::string_view &in) {
+  auto value = get_varint(in);
+  if (value > UINT32_MAX)
+    throw std::runtime_error("Malformed CRDT data");
+  return static_cast<std::uint32_t>(value);
+}
+
+std::string_view get_bytes(std::string_view &in, std::uint64_t size) {
+  if (size > in.size())
+    throw std::runtime_error("Malformed CRDT data");
+  auto bytes = in.substr(0, size);
+  in.remove_prefix(size);
+  return bytes;
+}
+
+// RGA order between runs competing for the same spot: the later insert
+// (higher clock, then higher client) goes first.
+bool precedes(const CrdtId &a, const CrdtId &b) {
+  return a.clock > b.clock || (a.clock == b.clock && a.client > b.client);
+}
+
+} // namespace
+
+void encode_crdt_op(const CrdtOp &op, std::string &out) {
+  if (op.kind == CrdtOp::Kind::insert) {
+    out += 'i';
+    put_varint(out, op.id.client);
+    put_varint(out, op.id.clock);
+    put_varint(out, op.origin.client);
+    put_varint(out, op.origin.clock);
+    put_varint(out, op.text.size());
+    out += op.text;
+    return;
+  }
+  out += 'd';
+  put_varint(out, op.spans.size());
+  for (const auto &span : op.spans) {
+    put_varint(out, span.start.client);
+    put_varint(out, span.start.clock);
+    put_varint(out, span.length);
+  }
+}
+
+CrdtOp decode_crdt_op(std::string_view in) {
+  CrdtOp op;
+  auto kind = get_bytes(in, 1);
+  if (kind == "i") {
+    op.id.client = get_client(in);
+    op.id.clock = get_varint(in);
+    op.origin.client = get_client(in);
+    op.origin.clock = get_varint(in);
+    op.text = get_bytes(in, get_varint(in));
+  } else if (kind == "d") {
+    op.kind = CrdtOp::Kind::erase;
+    auto count = get_varint(in);
+    for (std::uint64_t i = 0; i < count; ++i) {
+      CrdtSpan span;
+      span.start.client = get_client(in);
+      span.start.clock = get_varint(in);
+      span.length = get_varint(in);
+      op.spans.push_back(span);
+    }
+  } else {
+    throw std::runtime_error("Malformed CRDT data");
+  }
+  if (!in.empty())
+    throw std::runtime_error("Malformed CRDT data");
+  return op;
+}
+
+std::pair<TextCrdt::RunList::iterator, std::uint64_t>
+TextCrdt::find(CrdtId id) {
+  auto client = index.find(id.client);
+  if (client == index.end())
+    return {runs.end(), 0};
+  auto next = client->second.upper_bound(id.clock);
+  if (next == client->second.begin())
+    return {runs.end(), 0};
+  auto run = std::prev(next)->second;
+  if (id.clock >= run->id.clock + run->length)
+    return {runs.end(), 0};
+  return {run, id.clock - run->id.clock};
+}
+
+TextCrdt::RunList::iterator TextCrdt::split(RunList::iterator run,
+                                            std::uint64_t offset) {
+  Run tail;
+  tail.id = {run->id.client, run->id.clock + offset};
+  tail.origin = {run->id.client, run->id.clock + offset - 1};
+  tail.length = run->length - offset;
+  tail.deleted = run->deleted;
+  if (!run->deleted) {
+    tail.text = run->text.substr(offset);
+    run->text.resize(offset);
+  }
+  run->length = offset;
+  return add_run(std::next(run), std::move(tail));
+}
+
+TextCrdt::RunList::iterator TextCrdt::add_run(RunList::iterator before,
+                                              Run run) {
+  auto id = run.id;
+  auto added = runs.insert(before, std::move(run));
+  index[id.client][id.clock] = added;
+  return added;
+}
+
+bool TextCrdt::apply(const CrdtOp &op) {
+  if (op.kind == CrdtOp::Kind::insert)
+    return integrate(op);
+  for (const auto &span : op.spans) {
+    if (span.start.clock == 0 && span.length)
+      return false;
+  }
+  for (const auto &span : op.spans)
+    erase_span(span);
+  return true;
+}
+
+bool TextCrdt::integrate(const CrdtOp &op) {
+  const auto length = static_cast<std::uint64_t>(op.text.size());
+  const auto id = op.id;
+  if (!length || !id.clock || id.clock > UINT64_MAX - length)
+    return false;
+
+  // Already here, at least in part: a resent op.
+  if (auto client = index.find(id.client); client != index.end()) {
+    auto next = client->second.lower_bound(id.clock);
+    if (next != client->second.end() && next->first < id.clock + length)
+      return true;
+    if (find(id).first != runs.end())
+      return true;
+  }
+
+  auto pos = runs.begin();
+  auto left = runs.end(); // the run ending with origin
+  if (op.origin.clock) {
+    // The origin was seen by the inserter, so it must be older.
+    if (op.origin.clock >= id.clock)
+      return false;
+    auto [run, offset] = find(op.origin);
+    if (run == runs.end())
+      return false;
+    if (offset + 1 < run->length)
+      split(run, offset + 1);
+    left = run;
+    pos = std::next(run);
+  }
+
+  // Inserts made concurrently at the same spot are ordered newest first,
+  // which every replica agrees on.
+  auto first = pos;
+  while (pos != runs.end() && precedes(pos->id, id))
+    ++pos;
+
+  // Typing extends the run it continues instead of adding one per byte.
+  if (pos == first && left != runs.end() && !left->deleted &&
+      left->id.client == id.client &&
+      left->id.clock + left->length == id.clock) {
+    left->text += op.text;
+    left->length += length;
+  } else {
+    Run run;
+    run.id = id;
+    run.origin = op.origin;
+    run.length = length;
+    run.text = op.text;
+    add_run(pos, std::move(run));
+  }
+  visible += op.text.size();
+  clock = std::max(clock, id.clock + length - 1);
+  top_client = std::max(top_client, id.client);
+  return true;
+}
+
+void TextCrdt::erase_span(const CrdtSpan &span) {
+  auto client = index.find(span.start.client);
+  if (client == index.end())
+    return;
+  auto end = span.start.clock + span.length;
+  auto at = span.start.clock;
+  while (at < end) {
+    auto [run, offset] = find({span.start.client, at});
+    if (run == runs.end()) { // never inserted here; go to the next run
+      auto next = client->second.upper_bound(at);
+      if (next == client->second.end() || next->first >= end)
+        return;
+      at = next->first;
+      continue;
+    }
+    if (offset)
+      run = split(run, offset);
+    auto take = std::min(run->length, end - at);
+    if (take < run->length)
+      split(run, take);
+    if (!run->deleted) {
+      run->deleted = true;
+      visible -= run->text.size();
+      std::string().swap(run->text);
+    }
+    at += take;
+  }
+}
+
+CrdtOp TextCrdt::insert(std::uint32_t client, std::size_t pos,
+                        std::string text) {
+  CrdtOp op;
+  op.id = {client, clock + 1};
+  op.text = std::move(text);
+  // The origin is the visible byte just before pos.
+  std::size_t seen = 0;
+  for (auto run = runs.begin(); run != runs.end() && pos; ++run) {
+    if (run->deleted)
+      continue;
+    if (seen + run->length >= pos) {
+      op.origin = {run->id.client, run->id.clock + (pos - seen - 1)};
+      break;
+    }
+    seen += run->length;
+  }
+  if (!op.text.empty())
+    integrate(op);
+  return op;
+}
+
+CrdtOp TextCrdt::erase(std::size_t pos, std::size_t length) {
+  CrdtOp op;
+  op.kind = CrdtOp::Kind::erase;
+  std::size_t seen = 0;
+  for (auto run = runs.begin(); run != runs.end() && length; ++run) {
+    if (run->deleted)
+      continue;
+    if (seen + run->length <= pos) {
+      seen += run->length;
+      continue;
+    }
+    auto offset = pos > seen ? pos - seen : 0;
+    auto take = std::min<std::uint64_t>(run->length - offset, length);
+    op.spans.push_back({{run->id.client, run->id.clock + offset}, take});
+    length -= take;
+    seen += run->length;
+    pos = seen;
+  }
+  for (const auto &span : op.spans)
+    erase_span(span);
+  return op;
+}
+
+std::string TextCrdt::text() const {
+  std::string out;
+  out.reserve(visible);
+  for (const auto &run : runs)
+    out += run.text;
+  return out;
+}
+
+void TextCrdt::for_each_run(
+    const std::function<void(const Run &)> &visit) const {
+  for (const auto &run : runs)
+    visit(run);
+}
+
+void TextCrdt::encode(std::string &out) const {
+  // Runs split by edits that have since been deleted are joined up again.
+  std::vector<Run> joined;
+  for (const auto &run : runs) {
+    if (!joined.empty()) {
+      auto &last = joined.back();
+      if (last.deleted == run.deleted && last.id.client == run.id.client &&
+          last.id.clock + last.length == run.id.clock &&
+          run.origin.client == run.id.client &&
+          run.origin.clock + 1 == run.id.clock) {
+        last.length += run.length;
+        last.text += run.text;
+        continue;
+      }
+    }
+    joined.push_back(run);
+  }
+  put_varint(out, joined.size());
+  for (const auto &run : joined) {
+    put_varint(out, run.id.client);
+    put_varint(out, run.id.clock);
+    put_varint(out, run.origin.client);
+    put_varint(out, run.origin.clock);
+    put_varint(out, run.length);
+    out += run.deleted ? '\1' : '\0';
+    if (!run.deleted)
+      out += run.text;
+  }
+}
+
+TextCrdt TextCrdt::decode(std::string_view in) {
+  TextCrdt crdt;
+  auto count = get_varint(in);
+  for (std::uint64_t i = 0; i < count; ++i) {
+    Run run;
+    run.id.client = get_client(in);
+    run.id.clock = get_varint(in);
+    run.origin.client = get_client(in);
+    run.origin.clock = get_varint(in);
+    run.length = get_varint(in);
+    run.deleted = get_bytes(in, 1) != std::string_view("\0", 1);
+    if (!run.length || !run.id.clock ||
+        run.id.clock > UINT64_MAX - run.length)
+      throw std::runtime_error("Malformed CRDT data");
+    if (!run.deleted)
+      run.text = get_bytes(in, run.length);
+    crdt.visible += run.text.size();
+    crdt.clock = std::max(crdt.clock, run.id.clock + run.length - 1);
+    crdt.top_client = std::max(crdt.top_client, run.id.client);
+    crdt.add_run(crdt.runs.end(), std::move(run));
+  }
+  if (!in.empty())
+    throw std::runtime_error("Malformed CRDT data");
+  return crdt;
+}
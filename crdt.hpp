@@ -0,0 +1,110 @@
+#ifndef CRDT_HPP
+#define CRDT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Names one byte of a document: the editor (client) that inserted it and the
+// Lamport clock it was inserted at. Clocks start at 1; clock 0 stands for
+// "nothing", e.g. the origin of text inserted at the very start.
+struct CrdtId {
+  std::uint32_t client = 0;
+  std::uint64_t clock = 0;
+};
+
+// The ids start, start + 1, ... of length bytes inserted by one client.
+struct CrdtSpan {
+  CrdtId start;
+  std::uint64_t length = 0;
+};
+
+struct CrdtOp {
+  enum class Kind { insert, erase };
+  Kind kind = Kind::insert;
+  // insert: text gets the ids id, id + 1, ... and goes right after the byte
+  // named origin, which the inserting client saw to its left.
+  CrdtId id;
+  CrdtId origin;
+  std::string text;
+  // erase: the bytes to delete.
+  std::vector<CrdtSpan> spans;
+};
+
+// The compact form ops are logged in; decode throws std::runtime_error if in
+// is malformed.
+void encode_crdt_op(const CrdtOp &op, std::string &out);
+CrdtOp decode_crdt_op(std::string_view in);
+
+// A replica of a document's text as a sequence CRDT (RGA). Replicas that
+// have applied the same ops hold the same text, whatever order concurrent
+// ops arrived in, as long as every op arrives after the ops it refers to.
+//
+// Text is stored as runs: consecutive bytes one client typed in one go share
+// a single entry, which is split only where another edit lands inside it.
+// Deleted bytes stay behind as tombstones (without their text) because later
+// ops may still refer to them.
+class TextCrdt {
+public:
+  struct Run {
+    CrdtId id; // of the first byte; byte i has clock id.clock + i
+    CrdtId origin; // of the first byte; byte i > 0 follows byte i - 1
+    std::uint64_t length = 0;
+    std::string text; // empty once deleted
+    bool deleted = false;
+  };
+
+  // Integrate an op from any replica. Returns false, changing nothing, if it
+  // is malformed or refers to bytes this replica has not seen. Applying an
+  // op again is harmless.
+  bool apply(const CrdtOp &op);
+
+  // Edits made at this replica, at visible byte offsets. They are applied
+  // and returned for sending to the other replicas.
+  CrdtOp insert(std::uint32_t client, std::size_t pos, std::string text);
+  CrdtOp erase(std::size_t pos, std::size_t length);
+
+  std::string text() const;
+  std::size_t size() const { return visible; }
+  std::size_t run_count() const { return runs.size(); }
+  // Highest clock and client id seen so far. A client's next insert must
+  // use a clock above max_clock().
+  std::uint64_t max_clock() const { return clock; }
+  std::uint32_t max_client() const { return top_client; }
+
+  void for_each_run(const std::function<void(const Run &)> &visit) const;
+
+  // Snapshot of the whole replica; decode throws std::runtime_error if in
+  // is malformed.
+  void encode(std::string &out) const;
+  static TextCrdt decode(std::string_view in);
+
+private:
+  using RunList = std::list<Run>;
+
+  // The run holding id and id's offset into it; runs.end() if unknown.
+  std::pair<RunList::iterator, std::uint64_t> find(CrdtId id);
+  // Cut run at offset (0 < offset < length); returns the second half.
+  RunList::iterator split(RunList::iterator run, std::uint64_t offset);
+  RunList::iterator add_run(RunList::iterator before, Run run);
+  bool integrate(const CrdtOp &op);
+  void erase_span(const CrdtSpan &span);
+
+  RunList runs;
+  // Per client, its runs by first clock, so that ids are found in O(log n).
+  // List iterators stay valid as runs are added and split.
+  std::unordered_map<std::uint32_t, std::map<std::uint64_t, RunList::iterator>>
+      index;
+  std::size_t visible = 0;
+  std::uint64_t clock = 0;
+  std::uint32_t top_client = 0;
+};
+
+#endif // CRDT_HPP
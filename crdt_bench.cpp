@@ -0,0 +1,223 @@
+// Merge benchmark for the document CRDT. Simulated editors each keep a
+// replica and edit it concurrently; a relay replica standing in for the
+// server merges their ops in arrival order and fans them back out, as
+// doc_session does. Reports merge throughput at the relay and at the
+// editors, and fails if the replicas do not converge to the same text.
+#include "crdt.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct BenchOptions {
+  unsigned int editors = 32;
+  unsigned int rounds = 200;
+  unsigned int ops = 8;          // per editor per round
+  double jump = 0.1;             // chance an edit moves the cursor anywhere
+  double erase = 0.2;            // chance an edit is a delete
+  std::size_t seed_bytes = 4096; // text the document starts with
+  std::uint64_t seed = 1;
+};
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --editors=N     concurrent editors (default 32)\n"
+               "  --rounds=N      rounds of edits, each merged before the "
+               "next (default 200)\n"
+               "  --ops=N         edits per editor per round (default 8)\n"
+               "  --jump=P        chance an edit moves the cursor (default "
+               "0.1)\n"
+               "  --erase=P       chance an edit deletes (default 0.2)\n"
+               "  --seed-bytes=N  initial document size (default 4096)\n"
+               "  --seed=N        random seed (default 1)\n";
+}
+
+BenchOptions parse_options(int argc, char *argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+      throw std::invalid_argument("Unexpected argument: " + arg);
+    auto key = arg.substr(2, eq - 2);
+    auto value = arg.substr(eq + 1);
+    if (key == "editors")
+      options.editors = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "rounds")
+      options.rounds = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "ops")
+      options.ops = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "jump")
+      options.jump = std::stod(value);
+    else if (key == "erase")
+      options.erase = std::stod(value);
+    else if (key == "seed-bytes")
+      options.seed_bytes = std::stoul(value);
+    else if (key == "seed")
+      options.seed = std::stoull(value);
+    else
+      throw std::invalid_argument("Unknown option: " + arg);
+  }
+  if (options.editors == 0)
+    throw std::invalid_argument("--editors must be positive");
+  return options;
+}
+
+struct Editor {
+  std::uint32_t client = 0;
+  TextCrdt replica;
+  std::size_t cursor = 0;
+  std::vector<CrdtOp> outbox;
+};
+
+struct Relayed {
+  std::uint32_t client;
+  CrdtOp op;
+};
+
+// One edit at the editor's cursor, the way a person types: mostly inserting
+// a few characters or backspacing, now and then jumping elsewhere.
+void edit(Editor &editor, const BenchOptions &options, std::mt19937_64 &rng) {
+  std::uniform_real_distribution<double> chance(0, 1);
+  auto size = editor.replica.size();
+  editor.cursor = std::min(editor.cursor, size);
+  if (chance(rng) < options.jump)
+    editor.cursor = std::uniform_int_distribution<std::size_t>(0, size)(rng);
+  if (chance(rng) < options.erase && editor.cursor > 0) {
+    auto length = std::min<std::size_t>(
+        editor.cursor, std::uniform_int_distribution<std::size_t>(1, 4)(rng));
+    editor.cursor -= length;
+    editor.outbox.push_back(editor.replica.erase(editor.cursor, length));
+    return;
+  }
+  std::string text(std::uniform_int_distribution<std::size_t>(1, 8)(rng),
+                   'a' + static_cast<char>(editor.client % 26));
+  auto length = text.size();
+  editor.outbox.push_back(
+      editor.replica.insert(editor.client, editor.cursor, std::move(text)));
+  editor.cursor += length;
+}
+
+double seconds(clock_type::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchOptions options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::mt19937_64 rng(options.seed);
+  // The document as it was before anyone started editing it live.
+  TextCrdt relay;
+  relay.insert(0, 0, std::string(options.seed_bytes, '.'));
+  std::string snapshot;
+  relay.encode(snapshot);
+
+  std::vector<Editor> editors;
+  for (unsigned int i = 0; i < options.editors; ++i) {
+    editors.emplace_back();
+    editors.back().client = i + 1;
+    editors.back().replica = TextCrdt::decode(snapshot);
+  }
+
+  std::size_t relay_ops = 0, replica_ops = 0;
+  clock_type::duration relay_time{}, replica_time{};
+  std::vector<Relayed> relayed;
+  for (unsigned int round = 0; round < options.rounds; ++round) {
+    // Everyone edits their own replica without seeing the others' edits.
+    for (auto &editor : editors) {
+      for (unsigned int i = 0; i < options.ops; ++i)
+        edit(editor, options, rng);
+    }
+
+    // The relay receives the outboxes interleaved, each in order.
+    std::vector<std::size_t> next(editors.size());
+    std::vector<std::size_t> pending;
+    for (std::size_t i = 0; i < editors.size(); ++i)
+      pending.push_back(i);
+    relayed.clear();
+    auto started = clock_type::now();
+    while (!pending.empty()) {
+      auto pick = std::uniform_int_distribution<std::size_t>(
+          0, pending.size() - 1)(rng);
+      auto &editor = editors[pending[pick]];
+      auto &op = editor.outbox[next[pending[pick]]++];
+      if (!relay.apply(op)) {
+        std::cerr << "Relay rejected an op in round " << round << '\n';
+        return EXIT_FAILURE;
+      }
+      relayed.push_back({editor.client, std::move(op)});
+      if (next[pending[pick]] == editor.outbox.size()) {
+        pending[pick] = pending.back();
+        pending.pop_back();
+      }
+    }
+    relay_time += clock_type::now() - started;
+    relay_ops += relayed.size();
+
+    // Each editor merges everyone else's ops in the relay's order.
+    started = clock_type::now();
+    for (auto &editor : editors) {
+      for (const auto &item : relayed) {
+        if (item.client == editor.client)
+          continue;
+        if (!editor.replica.apply(item.op)) {
+          std::cerr << "Editor rejected an op in round " << round << '\n';
+          return EXIT_FAILURE;
+        }
+        ++replica_ops;
+      }
+      editor.outbox.clear();
+    }
+    replica_time += clock_type::now() - started;
+  }
+
+  auto text = relay.text();
+  for (const auto &editor : editors) {
+    if (editor.replica.text() != text) {
+      std::cerr << "Editor " << editor.client << " diverged\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  snapshot.clear();
+  auto started = clock_type::now();
+  relay.encode(snapshot);
+  auto decoded = TextCrdt::decode(snapshot);
+  auto snapshot_time = clock_type::now() - started;
+  if (decoded.text() != text) {
+    std::cerr << "Snapshot does not round-trip\n";
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%u editors, %u rounds of %u edits each\n", options.editors,
+              options.rounds, options.ops);
+  std::printf("relay merge    %10zu ops %12.0f ops/s\n", relay_ops,
+              relay_ops / seconds(relay_time));
+  std::printf("replica merge  %10zu ops %12.0f ops/s\n", replica_ops,
+              replica_ops / seconds(replica_time));
+  std::printf("document       %10zu bytes in %zu runs\n", text.size(),
+              relay.run_count());
+  std::printf("snapshot       %10zu bytes, encode + decode %.3f ms\n",
+              snapshot.size(), seconds(snapshot_time) * 1000);
+  std::printf("converged\n");
+  return EXIT_SUCCESS;
+}
@@ -1,291 +1,958 @@
 #include "database.hpp"
-#include "base64.hpp"
+#include "delta.hpp"
+#include "lz4.hpp"
+#include "metrics.hpp"
 #include <ctime>
 #include <stdexcept>
 
 std::time_t now() { return std::time(0); }
 
-Database::Database(const std::string &db_name) : db(nullptr) {
-  int rc = sqlite3_open(db_name.c_str(), &db);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Cannot open database: " +
-                             std::string(sqlite3_errmsg(db)));
+// Each Connection is serialized by its own mutex, so SQLite's per-connection
+// locking is not needed on top of that.
+static constexpr int open_flags = SQLITE_OPEN_NOMUTEX;
+
+// Bind text without copying it. The caller's string only has to outlive the
+// Statement: its destructor resets the statement and clears the bindings.
+static void bind_text(sqlite3_stmt *stmt, int index, std::string_view text) {
+  // A null pointer would bind NULL rather than an empty string.
+  sqlite3_bind_text(stmt, index, text.empty() ? "" : text.data(),
+                    static_cast<int>(text.size()), SQLITE_STATIC);
+}
+
+// Column i of the current row, valid until the next step or reset.
+static std::string_view column_text(sqlite3_stmt *stmt, int i) {
+  auto text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, i));
+  if (!text)
+    return {};
+  return {text, static_cast<std::size_t>(sqlite3_column_bytes(stmt, i))};
+}
+
+static std::string_view column_blob(sqlite3_stmt *stmt, int i) {
+  auto blob = static_cast<const char *>(sqlite3_column_blob(stmt, i));
+  if (!blob)
+    return {};
+  return {blob, static_cast<std::size_t>(sqlite3_column_bytes(stmt, i))};
+}
+
+// Step a statement that returns no rows; throws if it fails.
+static void step_done(Connection &conn, sqlite3_stmt *stmt, const char *what) {
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) {
+    metrics::record_sqlite_error(rc);
+    throw std::runtime_error(std::string("Failed to execute ") + what + ": " +
+                             sqlite3_errmsg(conn.handle()));
   }
 }
 
-Database::~Database() {
-  if (db) {
-    sqlite3_close(db);
+// docs.content holds either the text itself, as TEXT, or a BLOB: the tag
+// content_lz4, the text's length as 4 bytes little endian, then the text
+// compressed with lz4_compress. Rows from before compression, and content
+// that is short or does not compress, are TEXT.
+static constexpr char content_lz4 = 1;
+static constexpr std::size_t content_header = 5;
+
+// Length of the text a BLOB content holds, from its header.
+static std::size_t compressed_length(std::string_view stored) {
+  if (stored.size() < content_header || stored[0] != content_lz4)
+    throw std::runtime_error("Unknown doc content format");
+  std::size_t length = 0;
+  for (std::size_t i = content_header - 1; i > 0; --i)
+    length = length << 8 | static_cast<unsigned char>(stored[i]);
+  return length;
+}
+
+// Bind content in its stored form. A compressed form is built in scratch,
+// which must outlive the statement like text bound with bind_text.
+static void bind_content(sqlite3_stmt *stmt, int index,
+                         std::string_view content, std::size_t compress_min,
+                         std::string &scratch) {
+  if (compress_min && content.size() >= compress_min &&
+      content.size() <= UINT32_MAX) {
+    scratch.assign(1, content_lz4);
+    for (std::size_t i = 0; i < content_header - 1; ++i)
+      scratch += static_cast<char>(content.size() >> (8 * i));
+    lz4_compress(content, scratch);
+    // Only worth decompressing on every read if it saves an eighth.
+    if (scratch.size() <= content.size() - content.size() / 8) {
+      sqlite3_bind_blob(stmt, index, scratch.data(),
+                        static_cast<int>(scratch.size()), SQLITE_STATIC);
+      return;
+    }
   }
+  bind_text(stmt, index, content);
 }
 
-void Database::execute(const std::string &sql) {
-  char *err_msg = nullptr;
-  int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg);
-  if (rc != SQLITE_OK) {
-    std::string error = "SQL error: " + std::string(err_msg);
-    sqlite3_free(err_msg);
-    throw std::runtime_error(error);
+// Column i as docs.content stores it; compressed text is decompressed into
+// scratch.
+static std::string_view column_content(sqlite3_stmt *stmt, int i,
+                                       std::string &scratch) {
+  if (sqlite3_column_type(stmt, i) != SQLITE_BLOB)
+    return column_text(stmt, i);
+  auto stored = column_blob(stmt, i);
+  scratch.resize(compressed_length(stored));
+  lz4_decompress(stored.substr(content_header), scratch.data(),
+                 scratch.size());
+  return scratch;
+}
+
+namespace {
+
+// Where a doc stands. Its newest doc_ops row carries the revision and
+// content length; a doc that was never edited has no rows and is at
+// revision 0.
+struct DocHead {
+  std::int64_t revision = 0;
+  std::int64_t length = 0;
+  std::int64_t logged = 0; // doc_ops rows
+};
+
+bool doc_head(Connection &conn, std::int64_t id, DocHead &head) {
+  {
+    auto stmt = conn.prepare(
+        "SELECT revision, length, (SELECT COUNT(*) FROM doc_ops "
+        "WHERE doc_id = ?1) FROM doc_ops WHERE doc_id = ?1 "
+        "ORDER BY revision DESC LIMIT 1");
+    sqlite3_bind_int64(stmt, 1, id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      head.revision = sqlite3_column_int64(stmt, 0);
+      head.length = sqlite3_column_int64(stmt, 1);
+      head.logged = sqlite3_column_int64(stmt, 2);
+      return true;
+    }
   }
+  // Only the first edit of a doc has to measure its content. Compressed
+  // content has its length in the header.
+  auto stmt = conn.prepare(
+      "SELECT CASE WHEN typeof(content) = 'blob' THEN substr(content, 1, 5) "
+      "ELSE length(CAST(content AS BLOB)) END FROM docs WHERE id = ?");
+  sqlite3_bind_int64(stmt, 1, id);
+  if (sqlite3_step(stmt) != SQLITE_ROW)
+    return false;
+  std::int64_t length = sqlite3_column_int64(stmt, 0);
+  if (sqlite3_column_type(stmt, 0) == SQLITE_BLOB)
+    length = static_cast<std::int64_t>(
+        compressed_length(column_blob(stmt, 0)));
+  head = {0, length, 0};
+  return true;
 }
 
-void Database::insert_chat(const std::string &workspace,
-                           const std::string &content) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(
-      db, "INSERT INTO chat (workspace, time, content) VALUES (?, ?, ?)", -1,
-      &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+// Visit doc id with its logged ops applied. Reads two tables, so it must run
+// inside a transaction for them to agree.
+bool read_doc(Connection &conn, std::int64_t id,
+              const Database::DocContentVisitor &visit) {
+  std::int64_t revision = 0;
+  std::string ops; // the log's entries back to back
+  {
+    auto stmt = conn.prepare(
+        "SELECT revision, ops FROM doc_ops WHERE doc_id = ? ORDER BY revision");
+    sqlite3_bind_int64(stmt, 1, id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      revision = sqlite3_column_int64(stmt, 0);
+      ops += column_blob(stmt, 1);
+    }
+  }
+  auto stmt = conn.prepare("SELECT title, content FROM docs WHERE id = ?");
+  sqlite3_bind_int64(stmt, 1, id);
+  if (sqlite3_step(stmt) != SQLITE_ROW)
+    return false;
+  std::string scratch;
+  auto stored = column_content(stmt, 1, scratch);
+  if (ops.empty()) {
+    visit(column_text(stmt, 0), stored, revision);
+    return true;
   }
+  std::string content(stored);
+  apply_doc_ops(ops, content);
+  visit(column_text(stmt, 0), content, revision);
+  return true;
+}
 
-  sqlite3_bind_text(stmt, 1, workspace.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, 2, now());
-  sqlite3_bind_text(stmt, 3, content.c_str(), -1, SQLITE_TRANSIENT);
+// Fold the op log of doc id into its docs row. The newest log row stays, with
+// its ops emptied, to keep the revision and length.
+void compact_doc(Connection &conn, std::int64_t id, std::size_t compress_min) {
+  std::string content;
+  std::int64_t revision = 0;
+  read_doc(conn, id,
+           [&](std::string_view, std::string_view text, std::int64_t rev) {
+             content.assign(text);
+             revision = rev;
+           });
+  {
+    std::string stored;
+    auto stmt = conn.prepare("UPDATE docs SET content = ? WHERE id = ?");
+    bind_content(stmt, 1, content, compress_min, stored);
+    sqlite3_bind_int64(stmt, 2, id);
+    step_done(conn, stmt, "update statement");
+  }
+  {
+    auto stmt =
+        conn.prepare("DELETE FROM doc_ops WHERE doc_id = ? AND revision < ?");
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_int64(stmt, 2, revision);
+    step_done(conn, stmt, "delete statement");
+  }
+  auto stmt = conn.prepare(
+      "UPDATE doc_ops SET ops = x'' WHERE doc_id = ? AND revision = ?");
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_int64(stmt, 2, revision);
+  step_done(conn, stmt, "update statement");
+}
 
-  rc = sqlite3_step(stmt);
-  if (rc != SQLITE_DONE) {
-    sqlite3_finalize(stmt);
-    throw std::runtime_error("Failed to execute insert statement: " +
-                             std::string(sqlite3_errmsg(db)));
+// After the docs row of id was rewritten with length bytes of content: make
+// that the next revision, with nothing left in the log. Returns the revision.
+std::int64_t next_revision(Connection &conn, std::int64_t id,
+                           std::size_t length) {
+  {
+    auto stmt = conn.prepare(
+        "INSERT INTO doc_ops (doc_id, revision, length, ops) "
+        "SELECT ?1, COALESCE(MAX(revision), 0) + 1, ?2, x'' "
+        "FROM doc_ops WHERE doc_id = ?1");
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_int64(stmt, 2, static_cast<std::int64_t>(length));
+    step_done(conn, stmt, "insert statement");
   }
-  sqlite3_finalize(stmt);
+  std::int64_t revision = 0;
+  {
+    auto stmt =
+        conn.prepare("SELECT MAX(revision) FROM doc_ops WHERE doc_id = ?");
+    sqlite3_bind_int64(stmt, 1, id);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      revision = sqlite3_column_int64(stmt, 0);
+  }
+  auto stmt =
+      conn.prepare("DELETE FROM doc_ops WHERE doc_id = ? AND revision < ?");
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_int64(stmt, 2, revision);
+  step_done(conn, stmt, "delete statement");
+  return revision;
 }
 
-void Database::insert_doc(const std::string &workspace, const std::string &date,
-                          const std::string &title,
-                          const std::string &content) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(db,
-                              "INSERT INTO docs (workspace, time, date, title, "
-                              "content) VALUES (?, ?, ?, ?, ?)",
-                              -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+// Whether doc id exists and belongs to workspace.
+bool doc_in_workspace(Connection &conn, std::int64_t id,
+                      std::string_view workspace) {
+  auto stmt = conn.prepare("SELECT 1 FROM docs WHERE id = ? AND workspace = ?");
+  sqlite3_bind_int64(stmt, 1, id);
+  bind_text(stmt, 2, workspace);
+  return sqlite3_step(stmt) == SQLITE_ROW;
+}
+
+// The newest revision in a doc's history, -1 if there is none, and how many
+// deltas it is from the keyframe it builds on.
+struct HistoryHead {
+  std::int64_t revision = -1;
+  std::int64_t depth = 0;
+};
+
+HistoryHead history_head(Connection &conn, std::int64_t id) {
+  HistoryHead head;
+  auto stmt = conn.prepare("SELECT revision, depth FROM doc_revisions "
+                           "WHERE doc_id = ? ORDER BY revision DESC LIMIT 1");
+  sqlite3_bind_int64(stmt, 1, id);
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    head.revision = sqlite3_column_int64(stmt, 0);
+    head.depth = sqlite3_column_int64(stmt, 1);
   }
+  return head;
+}
 
-  sqlite3_bind_text(stmt, 1, workspace.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, 2, now());
-  sqlite3_bind_text(stmt, 3, date.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 4, title.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 5, content.c_str(), -1, SQLITE_TRANSIENT);
+// Whether the revision after head, length bytes long, is kept as a delta of
+// delta_size bytes: not once the chain is as long as it may get, nor when
+// the delta saves too little over a keyframe to be worth the chain.
+bool keep_delta(const HistoryHead &head, std::size_t delta_size,
+                std::size_t length) {
+  return head.depth + 1 < Database::revision_keyframe_every &&
+         delta_size < length / 2;
+}
 
-  rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+// Add revision of doc id, length bytes long, to its history: data is the
+// content itself if depth is 0, else the delta from the revision before.
+void insert_revision(Connection &conn, std::int64_t id,
+                     std::int64_t revision, std::size_t length,
+                     std::int64_t depth, std::string_view data,
+                     std::size_t compress_min) {
+  std::string stored;
+  auto stmt = conn.prepare(
+      "INSERT OR REPLACE INTO doc_revisions (doc_id, revision, time, length, "
+      "depth, data) VALUES (?, ?, ?, ?, ?, ?)");
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_int64(stmt, 2, revision);
+  sqlite3_bind_int64(stmt, 3, now());
+  sqlite3_bind_int64(stmt, 4, static_cast<std::int64_t>(length));
+  sqlite3_bind_int64(stmt, 5, depth);
+  if (depth == 0)
+    bind_content(stmt, 6, data, compress_min, stored);
+  else
+    sqlite3_bind_blob(stmt, 6, data.data(), static_cast<int>(data.size()),
+                      SQLITE_STATIC);
+  step_done(conn, stmt, "insert statement");
 }
 
-void Database::update_doc(const std::string &id, const std::string &title,
-                          const std::string &content) {
-  sqlite3_stmt *stmt;
-  int64_t long_id = std::stol(id);
-  int rc = sqlite3_prepare_v2(
-      db, "UPDATE docs SET title = ?, content = ? WHERE id = ?", -1, &stmt,
-      nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+// Add revision of doc id, with content after, to its history; previous is
+// the revision before, with content before. A history that stops short of
+// previous, as for docs saved before history was kept, starts there with a
+// keyframe.
+void record_revision(Connection &conn, std::int64_t id,
+                     std::int64_t previous, std::string_view before,
+                     std::int64_t revision, std::string_view after,
+                     std::size_t compress_min) {
+  auto head = history_head(conn, id);
+  if (head.revision != previous) {
+    insert_revision(conn, id, previous, before.size(), 0, before,
+                    compress_min);
+    head = {previous, 0};
   }
+  std::string delta;
+  if (head.depth + 1 < Database::revision_keyframe_every)
+    make_delta(before, after, delta);
+  if (keep_delta(head, delta.size(), after.size()))
+    insert_revision(conn, id, revision, after.size(), head.depth + 1, delta,
+                    compress_min);
+  else
+    insert_revision(conn, id, revision, after.size(), 0, after, compress_min);
+}
 
-  sqlite3_bind_text(stmt, 1, title.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 2, content.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, 3, long_id);
+} // namespace
+
+Database::Database(const std::string &db_name, std::size_t reader_count)
+    : write_conn(std::make_unique<Connection>(
+          db_name, open_flags | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) {
+  if (db_name == ":memory:" || db_name.empty())
+    return; // every connection would get a private database
+
+  // WAL lets readers proceed while a write transaction is open. FULL syncs
+  // the WAL on every commit, so a write is durable once its commit returns;
+  // WriteBatcher spreads that sync over every request in a batch.
+  write_conn->execute("PRAGMA journal_mode=WAL");
+  write_conn->execute("PRAGMA synchronous=FULL");
+  write_conn->execute("PRAGMA mmap_size=268435456");
+  write_conn->execute("PRAGMA cache_size=-16384");
+
+  for (std::size_t i = 0; i < reader_count; ++i) {
+    auto conn = std::make_unique<Connection>(
+        db_name, open_flags | SQLITE_OPEN_READONLY);
+    conn->execute("PRAGMA mmap_size=268435456");
+    conn->execute("PRAGMA cache_size=-16384");
+    read_conns.push_back(std::move(conn));
+  }
+}
 
-  rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+Database::~Database() = default;
+
+Database::Lease Database::writer() {
+  auto started = metrics::clock::now();
+  return {std::unique_lock<std::recursive_mutex>(write_conn->mutex),
+          write_conn.get(), started};
 }
 
-void Database::delete_doc(const std::string &id) {
-  sqlite3_stmt *stmt;
-  int64_t long_id = std::stol(id);
-  int rc = sqlite3_prepare_v2(db, "DELETE FROM docs WHERE id = ?", -1, &stmt,
-                              nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+Database::Lease Database::reader() {
+  if (read_conns.empty())
+    return writer();
+
+  auto started = metrics::clock::now();
+  // Take the first idle reader, starting from a rotating offset; if all are
+  // busy, queue on the one we started from.
+  std::size_t start = next_reader.fetch_add(1, std::memory_order_relaxed);
+  for (std::size_t i = 0; i < read_conns.size(); ++i) {
+    Connection *conn = read_conns[(start + i) % read_conns.size()].get();
+    std::unique_lock<std::recursive_mutex> lock(conn->mutex,
+                                                std::try_to_lock);
+    if (lock.owns_lock())
+      return {std::move(lock), conn, started};
   }
+  Connection *conn = read_conns[start % read_conns.size()].get();
+  return {std::unique_lock<std::recursive_mutex>(conn->mutex), conn,
+          started};
+}
 
-  sqlite3_bind_int64(stmt, 1, long_id);
-  rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+std::uint64_t Database::statement_cache_hits() const {
+  std::uint64_t hits = write_conn->statement_cache().hits();
+  for (auto &conn : read_conns)
+    hits += conn->statement_cache().hits();
+  return hits;
 }
 
-void Database::upsert_online_users(const std::string workspace,
-                                   const std::string user_id) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(
-      db,
-      "INSERT INTO online_users (workspace, user_id, last_ping) VALUES (?,"
-      "?, ?) ON CONFLICT(workspace, user_id) DO "
-      "UPDATE SET last_ping=excluded.last_ping",
-      -1, &stmt, nullptr);
+std::uint64_t Database::statement_cache_misses() const {
+  std::uint64_t misses = write_conn->statement_cache().misses();
+  for (auto &conn : read_conns)
+    misses += conn->statement_cache().misses();
+  return misses;
+}
 
+std::uint64_t Database::page_cache_hits() const {
+  std::uint64_t hits = write_conn->page_cache_hits();
+  for (auto &conn : read_conns)
+    hits += conn->page_cache_hits();
+  return hits;
+}
+
+std::uint64_t Database::page_cache_misses() const {
+  std::uint64_t misses = write_conn->page_cache_misses();
+  for (auto &conn : read_conns)
+    misses += conn->page_cache_misses();
+  return misses;
+}
+
+void Database::execute(const std::string &sql) { writer()->execute(sql); }
+
+std::int64_t Database::query_int64(const std::string &sql) {
+  auto conn = writer();
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(conn->handle(), sql.c_str(), -1, &stmt, nullptr);
   if (rc != SQLITE_OK) {
+    metrics::record_sqlite_error(rc);
     throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+                             std::string(sqlite3_errmsg(conn->handle())));
   }
+  std::int64_t value = 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    value = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return value;
+}
 
-  sqlite3_bind_text(stmt, 1, workspace.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 2, user_id.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, 3, now());
+std::int64_t Database::insert_chat(const std::string &workspace,
+                                   std::string_view content) {
+  auto conn = writer();
+  auto stmt = conn->prepare(
+      "INSERT INTO chat (workspace, time, content) VALUES (?, ?, ?)");
+
+  bind_text(stmt, 1, workspace);
+  sqlite3_bind_int64(stmt, 2, now());
+  bind_text(stmt, 3, content);
 
-  rc = sqlite3_step(stmt);
+  int rc = sqlite3_step(stmt);
   if (rc != SQLITE_DONE) {
-    sqlite3_finalize(stmt);
+    metrics::record_sqlite_error(rc);
     throw std::runtime_error("Failed to execute insert statement: " +
-                             std::string(sqlite3_errmsg(db)));
+                             std::string(sqlite3_errmsg(conn->handle())));
   }
-  sqlite3_finalize(stmt);
+  return sqlite3_last_insert_rowid(conn->handle());
 }
 
-std::vector<std::string>
-Database::select_chats_by_workspace(const std::string &workspace) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(db,
-                              "SELECT content FROM chat "
-                              "WHERE workspace = ? ORDER BY time ASC",
-                              -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+std::int64_t Database::insert_doc(const std::string &workspace,
+                                  std::string_view date,
+                                  std::string_view title,
+                                  std::string_view content) {
+  std::string stored;
+  auto conn = writer();
+  auto stmt = conn->prepare("INSERT INTO docs (workspace, time, date, "
+                            "title, content) VALUES (?, ?, ?, ?, ?)");
+
+  bind_text(stmt, 1, workspace);
+  sqlite3_bind_int64(stmt, 2, now());
+  bind_text(stmt, 3, date);
+  bind_text(stmt, 4, title);
+  bind_content(stmt, 5, content, compress_min, stored);
+  step_done(*conn, stmt, "insert statement");
+  auto id = sqlite3_last_insert_rowid(conn->handle());
+  insert_revision(*conn, id, 0, content.size(), 0, content, compress_min);
+  return id;
+}
+
+void Database::update_doc(const std::string &workspace, const std::string &id,
+                          std::string_view title, std::string_view content) {
+  int64_t long_id = std::stol(id);
+  std::string before, stored;
+  std::int64_t previous = 0;
+  auto conn = writer();
+  if (!doc_in_workspace(*conn, long_id, workspace))
+    return;
+  // What it replaces, for the delta in its history.
+  if (!read_doc(*conn, long_id,
+                [&](std::string_view, std::string_view text,
+                    std::int64_t revision) {
+                  before.assign(text);
+                  previous = revision;
+                }))
+    return;
+  {
+    auto stmt =
+        conn->prepare("UPDATE docs SET title = ?, content = ? WHERE id = ?");
+
+    bind_text(stmt, 1, title);
+    bind_content(stmt, 2, content, compress_min, stored);
+    sqlite3_bind_int64(stmt, 3, long_id);
+
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+      metrics::record_sqlite_error(rc);
+    if (rc != SQLITE_DONE || sqlite3_changes(conn->handle()) == 0)
+      return;
   }
 
-  sqlite3_bind_text(stmt, 1, workspace.c_str(), -1, SQLITE_TRANSIENT);
+  auto revision = next_revision(*conn, long_id, content.size());
+  record_revision(*conn, long_id, previous, before, revision, content,
+                  compress_min);
+}
 
-  std::vector<std::string> results;
-  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-    results.push_back(std::string(
-        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))));
+DocEdit Database::edit_doc(const std::string &workspace, const std::string &id,
+                           std::int64_t base, const std::vector<DocOp> &ops,
+                           std::int64_t &revision) {
+  int64_t long_id = std::stol(id);
+  auto conn = writer();
+  DocHead head;
+  if (!doc_in_workspace(*conn, long_id, workspace) ||
+      !doc_head(*conn, long_id, head))
+    return DocEdit::missing;
+  revision = head.revision;
+  if (base != head.revision)
+    return DocEdit::conflict;
+  auto length = static_cast<std::size_t>(head.length);
+  if (!apply_length(ops, length))
+    return DocEdit::out_of_range;
+
+  // The ops are the delta in the doc's history, so an edit only reads the
+  // content when the history needs a keyframe.
+  auto content = [&] {
+    std::string text;
+    read_doc(*conn, long_id,
+             [&](std::string_view, std::string_view stored, std::int64_t) {
+               text.assign(stored);
+             });
+    return text;
+  };
+  auto history = history_head(*conn, long_id);
+  if (history.revision != head.revision) {
+    insert_revision(*conn, long_id, head.revision,
+                    static_cast<std::size_t>(head.length), 0, content(),
+                    compress_min);
+    history = {head.revision, 0};
   }
-  sqlite3_finalize(stmt);
-  return results;
+
+  std::string encoded;
+  encode_doc_ops(ops, encoded);
+  {
+    auto stmt = conn->prepare("INSERT INTO doc_ops (doc_id, revision, length, "
+                              "ops) VALUES (?, ?, ?, ?)");
+    sqlite3_bind_int64(stmt, 1, long_id);
+    sqlite3_bind_int64(stmt, 2, head.revision + 1);
+    sqlite3_bind_int64(stmt, 3, static_cast<std::int64_t>(length));
+    sqlite3_bind_blob(stmt, 4, encoded.data(),
+                      static_cast<int>(encoded.size()), SQLITE_STATIC);
+    step_done(*conn, stmt, "insert statement");
+  }
+  revision = head.revision + 1;
+
+  std::string delta;
+  make_delta(ops, static_cast<std::size_t>(head.length), delta);
+  if (keep_delta(history, delta.size(), length))
+    insert_revision(*conn, long_id, revision, length, history.depth + 1,
+                    delta, compress_min);
+  else
+    insert_revision(*conn, long_id, revision, length, 0, content(),
+                    compress_min);
+
+  if (head.logged + 1 >= doc_ops_compact_after)
+    compact_doc(*conn, long_id, compress_min);
+  return DocEdit::applied;
 }
 
-std::vector<std::string>
-Database::select_online_users_by_workspace(const std::string &workspace) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(db,
-                              "SELECT user_id FROM online_users WHERE "
-                              "workspace = ? AND last_ping >= ?",
-                              -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+void Database::delete_doc(const std::string &workspace,
+                          const std::string &id) {
+  int64_t long_id = std::stol(id);
+  auto conn = writer();
+  {
+    auto stmt =
+        conn->prepare("DELETE FROM docs WHERE id = ? AND workspace = ?");
+
+    sqlite3_bind_int64(stmt, 1, long_id);
+    bind_text(stmt, 2, workspace);
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+      metrics::record_sqlite_error(rc);
+    // The rest is the doc's own; leave it if the doc was not.
+    if (rc != SQLITE_DONE || sqlite3_changes(conn->handle()) == 0)
+      return;
+  }
+  for (auto sql : {"DELETE FROM doc_ops WHERE doc_id = ?",
+                   "DELETE FROM doc_revisions WHERE doc_id = ?",
+                   "DELETE FROM crdt_ops WHERE doc_id = ?",
+                   "DELETE FROM crdt_snapshots WHERE doc_id = ?"}) {
+    auto stmt = conn->prepare(sql);
+    sqlite3_bind_int64(stmt, 1, long_id);
+    step_done(*conn, stmt, "delete statement");
   }
+}
 
-  sqlite3_bind_text(stmt, 1, workspace.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, 2, now() - 20);
+void Database::insert_crdt_op(std::int64_t id, std::int64_t seq,
+                              std::string_view op) {
+  auto conn = writer();
+  auto stmt = conn->prepare("INSERT INTO crdt_ops (doc_id, seq, op) "
+                            "SELECT ?1, ?2, ?3 WHERE EXISTS "
+                            "(SELECT 1 FROM docs WHERE id = ?1)");
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_int64(stmt, 2, seq);
+  sqlite3_bind_blob(stmt, 3, op.data(), static_cast<int>(op.size()),
+                    SQLITE_STATIC);
+  step_done(*conn, stmt, "insert statement");
+}
 
-  std::vector<std::string> results;
-  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-    results.push_back(std::string(
-        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))));
+void Database::save_crdt(std::int64_t id, std::int64_t seq,
+                         std::string_view state, std::string_view text) {
+  std::string before, stored;
+  std::int64_t previous = 0;
+  auto conn = writer();
+  if (!read_doc(*conn, id,
+                [&](std::string_view, std::string_view content,
+                    std::int64_t revision) {
+                  before.assign(content);
+                  previous = revision;
+                }))
+    return;
+  {
+    auto stmt = conn->prepare("UPDATE docs SET content = ? WHERE id = ?");
+    bind_content(stmt, 1, text, compress_min, stored);
+    sqlite3_bind_int64(stmt, 2, id);
+    step_done(*conn, stmt, "update statement");
   }
-  sqlite3_finalize(stmt);
-  return results;
+  auto revision = next_revision(*conn, id, text.size());
+  record_revision(*conn, id, previous, before, revision, text,
+                  compress_min);
+  {
+    auto stmt = conn->prepare(
+        "INSERT OR REPLACE INTO crdt_snapshots (doc_id, revision, seq, state) "
+        "VALUES (?, ?, ?, ?)");
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_int64(stmt, 2, revision);
+    sqlite3_bind_int64(stmt, 3, seq);
+    sqlite3_bind_blob(stmt, 4, state.data(), static_cast<int>(state.size()),
+                      SQLITE_STATIC);
+    step_done(*conn, stmt, "insert statement");
+  }
+  auto stmt =
+      conn->prepare("DELETE FROM crdt_ops WHERE doc_id = ? AND seq <= ?");
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_int64(stmt, 2, seq);
+  step_done(*conn, stmt, "delete statement");
 }
 
-std::vector<std::pair<std::string, std::string>>
-Database::select_docs_by_workspace_and_date(const std::string &workspace,
-                                            const std::string &date) {
-  sqlite3_stmt *stmt;
-  int rc;
-  if (!date.empty()) {
-    rc =
-        sqlite3_prepare_v2(db,
-                           "SELECT id, title FROM docs "
-                           "WHERE workspace = ? AND date = ? ORDER BY time ASC",
-                           -1, &stmt, nullptr);
-  } else {
-    rc = sqlite3_prepare_v2(db,
-                            "SELECT id, title FROM docs "
-                            "WHERE workspace = ? ORDER BY time ASC",
-                            -1, &stmt, nullptr);
+void Database::upsert_online_users(const std::vector<OnlineUser> &users) {
+  auto conn = writer();
+  conn->execute("BEGIN");
+  try {
+    auto stmt = conn->prepare(
+        "INSERT INTO online_users (workspace, user_id, last_ping) VALUES (?,"
+        "?, ?) ON CONFLICT(workspace, user_id) DO "
+        "UPDATE SET last_ping=excluded.last_ping");
+    for (const auto &user : users) {
+      bind_text(stmt, 1, user.workspace);
+      bind_text(stmt, 2, user.user_id);
+      sqlite3_bind_int64(stmt, 3, user.last_ping);
+
+      int rc = sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      if (rc != SQLITE_DONE) {
+        metrics::record_sqlite_error(rc);
+        throw std::runtime_error("Failed to execute insert statement: " +
+                                 std::string(sqlite3_errmsg(conn->handle())));
+      }
+    }
+  } catch (...) {
+    conn->execute("ROLLBACK");
+    throw;
   }
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+  conn->execute("COMMIT");
+}
+
+std::vector<std::exception_ptr>
+Database::write_batch(const std::vector<std::function<void()>> &jobs) {
+  std::vector<std::exception_ptr> errors(jobs.size());
+  auto conn = writer();
+  conn->execute("BEGIN IMMEDIATE");
+  try {
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+      conn->execute("SAVEPOINT job");
+      try {
+        jobs[i]();
+      } catch (...) {
+        errors[i] = std::current_exception();
+        conn->execute("ROLLBACK TO job");
+      }
+      conn->execute("RELEASE job");
+    }
+    conn->execute("COMMIT");
+  } catch (...) {
+    try {
+      conn->execute("ROLLBACK");
+    } catch (const std::exception &) {
+      // The failed COMMIT may already have rolled back.
+    }
+    throw;
   }
+  return errors;
+}
+
+void Database::select_chats_by_workspace(const std::string &workspace,
+                                         std::int64_t since_id,
+                                         std::int64_t before_id,
+                                         std::int64_t limit,
+                                         const ChatVisitor &visit) {
+  // Both queries walk the (workspace, id) index from the cursor, so a page
+  // costs O(limit) no matter how long the history is. The newest page is
+  // read backwards and put back in order by SQLite, over at most limit rows.
+  bool newest_first = since_id <= 0 && limit >= 0;
+  auto conn = reader();
+  auto stmt = conn->prepare(
+      newest_first ? "SELECT id, content FROM (SELECT id, content FROM chat "
+                     "WHERE workspace = ? AND id > ? AND id < ? "
+                     "ORDER BY id DESC LIMIT ?) ORDER BY id ASC"
+                   : "SELECT id, content FROM chat WHERE workspace = ? "
+                     "AND id > ? AND id < ? ORDER BY id ASC LIMIT ?");
+
+  bind_text(stmt, 1, workspace);
+  sqlite3_bind_int64(stmt, 2, since_id);
+  sqlite3_bind_int64(stmt, 3, before_id);
+  sqlite3_bind_int64(stmt, 4, limit);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    visit(sqlite3_column_int64(stmt, 0), column_text(stmt, 1));
+}
+
+bool Database::has_chats_before(const std::string &workspace,
+                                std::int64_t before_id) {
+  auto conn = reader();
+  auto stmt = conn->prepare("SELECT EXISTS (SELECT 1 FROM chat "
+                            "WHERE workspace = ? AND id < ?)");
+
+  bind_text(stmt, 1, workspace);
+  sqlite3_bind_int64(stmt, 2, before_id);
+  return sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0);
+}
+
+std::vector<OnlineUser> Database::select_online_users(std::int64_t since) {
+  auto conn = reader();
+  auto stmt = conn->prepare("SELECT workspace, user_id, last_ping FROM "
+                            "online_users WHERE last_ping >= ?");
+
+  sqlite3_bind_int64(stmt, 1, since);
+
+  std::vector<OnlineUser> results;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    results.push_back(
+        {reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
+         reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
+         sqlite3_column_int64(stmt, 2)});
+  }
+  return results;
+}
 
-  sqlite3_bind_text(stmt, 1, workspace.c_str(), -1, SQLITE_TRANSIENT);
+void Database::select_docs_by_workspace_and_date(const std::string &workspace,
+                                                 std::string_view date,
+                                                 const DocVisitor &visit) {
+  auto conn = reader();
+  auto stmt = conn->prepare(
+      date.empty() ? "SELECT id, title FROM docs "
+                     "WHERE workspace = ? ORDER BY time ASC"
+                   : "SELECT id, title FROM docs "
+                     "WHERE workspace = ? AND date = ? ORDER BY time ASC");
+
+  bind_text(stmt, 1, workspace);
   if (!date.empty())
-    sqlite3_bind_text(stmt, 2, date.c_str(), -1, SQLITE_TRANSIENT);
+    bind_text(stmt, 2, date);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    visit(column_text(stmt, 0), column_text(stmt, 1));
+}
+
+std::optional<std::string>
+Database::select_password(std::string_view workspace) {
+  auto conn = reader();
+  auto stmt = conn->prepare("SELECT password FROM workspaces WHERE name = ?");
+  bind_text(stmt, 1, workspace);
+  if (sqlite3_step(stmt) != SQLITE_ROW)
+    return std::nullopt;
+  return std::string(column_text(stmt, 0));
+}
 
-  std::vector<std::pair<std::string, std::string>> results;
-  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-    results.push_back({std::string(reinterpret_cast<const char *>(
-                           sqlite3_column_text(stmt, 0))),
-                       std::string(reinterpret_cast<const char *>(
-                           sqlite3_column_text(stmt, 1)))});
+bool Database::insert_workspace(std::string_view workspace,
+                                std::string_view password) {
+  auto conn = writer();
+  // name has no UNIQUE constraint; the writer lock makes this check-and-insert
+  // atomic.
+  auto stmt = conn->prepare(
+      "INSERT INTO workspaces (name, password) SELECT ?1, ?2 "
+      "WHERE NOT EXISTS (SELECT 1 FROM workspaces WHERE name = ?1)");
+  bind_text(stmt, 1, workspace);
+  bind_text(stmt, 2, password);
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) {
+    metrics::record_sqlite_error(rc);
+    throw std::runtime_error("Failed to execute insert statement: " +
+                             std::string(sqlite3_errmsg(conn->handle())));
+  }
+  return sqlite3_changes(conn->handle()) > 0;
+}
+
+void Database::update_password(std::string_view workspace,
+                               std::string_view password) {
+  auto conn = writer();
+  auto stmt =
+      conn->prepare("UPDATE workspaces SET password = ? WHERE name = ?");
+  bind_text(stmt, 1, password);
+  bind_text(stmt, 2, workspace);
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) {
+    metrics::record_sqlite_error(rc);
+    throw std::runtime_error("Failed to execute update statement: " +
+                             std::string(sqlite3_errmsg(conn->handle())));
+  }
+}
+
+void Database::insert_session(const StoredSession &session) {
+  auto conn = writer();
+  auto stmt = conn->prepare(
+      "INSERT INTO sessions (token, workspace, expires) VALUES (?, ?, ?)");
+
+  bind_text(stmt, 1, session.token);
+  bind_text(stmt, 2, session.workspace);
+  sqlite3_bind_int64(stmt, 3, session.expires);
+
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) {
+    metrics::record_sqlite_error(rc);
+    throw std::runtime_error("Failed to execute insert statement: " +
+                             std::string(sqlite3_errmsg(conn->handle())));
+  }
+}
+
+void Database::delete_session(std::string_view token) {
+  auto conn = writer();
+  auto stmt = conn->prepare("DELETE FROM sessions WHERE token = ?");
+
+  bind_text(stmt, 1, token);
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE)
+    metrics::record_sqlite_error(rc);
+}
+
+std::vector<StoredSession> Database::select_sessions(std::int64_t now) {
+  auto conn = reader();
+  auto stmt = conn->prepare(
+      "SELECT token, workspace, expires FROM sessions WHERE expires > ?");
+
+  sqlite3_bind_int64(stmt, 1, now);
+
+  std::vector<StoredSession> results;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    results.push_back({std::string(column_text(stmt, 0)),
+                       std::string(column_text(stmt, 1)),
+                       sqlite3_column_int64(stmt, 2)});
   }
-  sqlite3_finalize(stmt);
   return results;
 }
 
-std::string Database::login(const std::string &id,
-                            const std::string &password) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(
-      db, "SELECT password FROM workspaces WHERE name = ?", -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
-  }
-
-  sqlite3_bind_text(stmt, 1, id.c_str(), -1, SQLITE_TRANSIENT);
-  if ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-    if (Base64::encode(password) ==
-        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0))) {
-      sqlite3_finalize(stmt);
-      return Base64::encode(id);
-    } else { // login fail
-      sqlite3_finalize(stmt);
-      return "";
-    }
-  } else { // sign up
-    rc = sqlite3_prepare_v2(
-        db, "INSERT INTO workspaces (name, password) VALUES (?, ?)", -1, &stmt,
-        nullptr);
-    if (rc != SQLITE_OK) {
-      throw std::runtime_error("Failed to prepare statement: " +
-                               std::string(sqlite3_errmsg(db)));
-    }
-    sqlite3_bind_text(stmt, 1, id.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, Base64::encode(password).c_str(), -1,
-                      SQLITE_TRANSIENT);
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-      sqlite3_finalize(stmt);
-      throw std::runtime_error("Failed to execute insert statement: " +
-                               std::string(sqlite3_errmsg(db)));
-    }
-    sqlite3_finalize(stmt);
-    return Base64::encode(id);
+void Database::delete_expired_sessions(std::int64_t now) {
+  auto conn = writer();
+  auto stmt = conn->prepare("DELETE FROM sessions WHERE expires <= ?");
+
+  sqlite3_bind_int64(stmt, 1, now);
+  int rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE)
+    metrics::record_sqlite_error(rc);
+}
+
+bool Database::get_doc_by_id(const std::string &workspace,
+                             const std::string &id,
+                             const DocContentVisitor &visit) {
+  int64_t long_id = std::stol(id);
+  auto conn = reader();
+  // A savepoint opens a read transaction, or nests in the writer's.
+  conn->execute("SAVEPOINT read_doc");
+  try {
+    bool found = doc_in_workspace(*conn, long_id, workspace) &&
+                 read_doc(*conn, long_id, visit);
+    conn->execute("RELEASE read_doc");
+    return found;
+  } catch (...) {
+    conn->execute("RELEASE read_doc");
+    throw;
   }
 }
 
-std::pair<std::string, std::string>
-Database::get_doc_by_id(const std::string &id) {
-  sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(
-      db, "SELECT title, content FROM docs WHERE id = ?", -1, &stmt, nullptr);
-  if (rc != SQLITE_OK) {
-    throw std::runtime_error("Failed to prepare statement: " +
-                             std::string(sqlite3_errmsg(db)));
+bool Database::load_crdt(const std::string &workspace, std::int64_t id,
+                         const DocContentVisitor &visit, StoredCrdt &crdt) {
+  auto conn = writer();
+  conn->execute("SAVEPOINT read_doc");
+  try {
+    bool found = doc_in_workspace(*conn, id, workspace) &&
+                 read_doc(*conn, id, visit);
+    if (found) {
+      {
+        auto stmt = conn->prepare("SELECT revision, seq, state FROM "
+                                  "crdt_snapshots WHERE doc_id = ?");
+        sqlite3_bind_int64(stmt, 1, id);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+          crdt.revision = sqlite3_column_int64(stmt, 0);
+          crdt.seq = sqlite3_column_int64(stmt, 1);
+          crdt.state.assign(column_blob(stmt, 2));
+        }
+      }
+      auto stmt = conn->prepare("SELECT op FROM crdt_ops WHERE doc_id = ? "
+                                "AND seq > ? ORDER BY seq");
+      sqlite3_bind_int64(stmt, 1, id);
+      sqlite3_bind_int64(stmt, 2, crdt.seq);
+      while (sqlite3_step(stmt) == SQLITE_ROW)
+        crdt.ops.emplace_back(column_blob(stmt, 0));
+    }
+    conn->execute("RELEASE read_doc");
+    return found;
+  } catch (...) {
+    conn->execute("RELEASE read_doc");
+    throw;
   }
+}
 
+void Database::select_doc_revisions(const std::string &workspace,
+                                    const std::string &id,
+                                    std::int64_t before, std::int64_t limit,
+                                    const RevisionVisitor &visit) {
   int64_t long_id = std::stol(id);
+  auto conn = reader();
+  auto stmt = conn->prepare(
+      "SELECT revision, time, length FROM doc_revisions WHERE doc_id = ?1 "
+      "AND revision < ?2 AND EXISTS (SELECT 1 FROM docs WHERE id = ?1 "
+      "AND workspace = ?4) ORDER BY revision DESC LIMIT ?3");
+
   sqlite3_bind_int64(stmt, 1, long_id);
+  sqlite3_bind_int64(stmt, 2, before);
+  sqlite3_bind_int64(stmt, 3, limit);
+  bind_text(stmt, 4, workspace);
 
-  if ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-    std::pair<std::string, std::string> result = {
-        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
-        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1))};
-    sqlite3_finalize(stmt);
-    return result;
-  } else {
-    sqlite3_finalize(stmt);
-    return {};
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    visit(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1),
+          sqlite3_column_int64(stmt, 2));
+}
+
+bool Database::get_doc_revision(const std::string &workspace,
+                                const std::string &id, std::int64_t revision,
+                                std::string &content, std::int64_t &time) {
+  int64_t long_id = std::stol(id);
+  auto conn = reader();
+  // A revision depth deltas after its keyframe is rebuilt from the rows
+  // that far back. Being one statement, they come from one snapshot.
+  auto stmt = conn->prepare(
+      "SELECT time, depth, data FROM doc_revisions WHERE doc_id = ?1 "
+      "AND revision BETWEEN ?2 - (SELECT depth FROM doc_revisions "
+      "WHERE doc_id = ?1 AND revision = ?2) AND ?2 AND EXISTS "
+      "(SELECT 1 FROM docs WHERE id = ?1 AND workspace = ?3) "
+      "ORDER BY revision");
+
+  sqlite3_bind_int64(stmt, 1, long_id);
+  sqlite3_bind_int64(stmt, 2, revision);
+  bind_text(stmt, 3, workspace);
+
+  bool found = false;
+  std::string scratch, next;
+  content.clear();
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (sqlite3_column_int64(stmt, 1) == 0) {
+      content.assign(column_content(stmt, 2, scratch));
+    } else {
+      apply_delta(content, column_blob(stmt, 2), next);
+      content.swap(next);
+    }
+    time = sqlite3_column_int64(stmt, 0);
+    found = true;
   }
+  return found;
 }
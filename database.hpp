@@ -1,39 +1,213 @@
 #ifndef DATABASE_HPP
 #define DATABASE_HPP
 
+#include "connection.hpp"
+#include "doc_ops.hpp"
+#include "metrics.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sqlite3.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
+struct OnlineUser {
+  std::string workspace;
+  std::string user_id;
+  std::int64_t last_ping;
+};
+
+struct StoredSession {
+  std::string token;
+  std::string workspace;
+  std::int64_t expires;
+};
+
+// What is stored of a live doc's CRDT: the snapshot taken when its text was
+// saved as revision, and the ops applied since, numbered on from seq.
+struct StoredCrdt {
+  std::int64_t revision = -1; // -1 if there is no snapshot
+  std::int64_t seq = 0;       // of the last op the snapshot includes
+  std::string state;
+  std::vector<std::string> ops; // seq + 1, seq + 2, ...
+};
+
+// Outcome of Database::edit_doc.
+enum class DocEdit {
+  applied,
+  conflict,     // the doc is no longer at the base revision
+  out_of_range, // an op reaches past the end of the content
+  missing       // no such doc
+};
+
 class Database {
 public:
-  explicit Database(const std::string &db_name = ":memory:");
+  // With reader_count > 0 the file is switched to WAL mode and queries are
+  // spread over that many read-only connections while writes go through a
+  // single writer. In-memory databases always use the writer alone.
+  explicit Database(const std::string &db_name = ":memory:",
+                    std::size_t reader_count = 0);
   ~Database();
 
   void execute(const std::string &sql);
-  void insert_chat(const std::string &workspace, const std::string &content);
-  void insert_doc(const std::string &workspace, const std::string &date,
-                  const std::string &title, const std::string &content);
-  void delete_doc(const std::string &id);
-  void update_doc(const std::string &id, const std::string &title,
-                  const std::string &content);
-  void upsert_online_users(const std::string workspace,
-                           const std::string user_id);
-
-  std::vector<std::string>
-  select_chats_by_workspace(const std::string &workspace);
-  std::vector<std::string>
-  select_online_users_by_workspace(const std::string &workspace);
-
-  std::string login(const std::string &id, const std::string &password);
-
-  std::vector<std::pair<std::string, std::string>>
-  select_docs_by_workspace_and_date(const std::string &workspace,
-                                    const std::string &date);
-  std::pair<std::string, std::string> get_doc_by_id(const std::string &id);
+  // First column of the first row returned by sql, or 0 if there is none.
+  std::int64_t query_int64(const std::string &sql);
+  // Text arguments are bound in place, without a copy.
+
+  // Returns the id of the new message.
+  std::int64_t insert_chat(const std::string &workspace,
+                           std::string_view content);
+  // Returns the id of the new doc.
+  std::int64_t insert_doc(const std::string &workspace, std::string_view date,
+                          std::string_view title, std::string_view content);
+  // Methods that take a doc id with a workspace only find the doc in that
+  // workspace; another workspace's doc is treated as missing.
+  void delete_doc(const std::string &workspace, const std::string &id);
+  // Replace title and content, starting a new revision.
+  void update_doc(const std::string &workspace, const std::string &id,
+                  std::string_view title, std::string_view content);
+  // Apply ops to doc id if it is still at revision base; revision is set to
+  // the doc's revision afterwards either way. The ops are appended to the
+  // doc's log in doc_ops instead of rewriting the docs row, so an edit costs
+  // about its own size. Once the log holds doc_ops_compact_after entries it
+  // is folded back into the row.
+  DocEdit edit_doc(const std::string &workspace, const std::string &id,
+                   std::int64_t base, const std::vector<DocOp> &ops,
+                   std::int64_t &revision);
+  static constexpr std::int64_t doc_ops_compact_after = 64;
+  // Log op number seq of live doc id; dropped if the doc is gone.
+  void insert_crdt_op(std::int64_t id, std::int64_t seq,
+                      std::string_view op);
+  // Save text as doc id's content, starting a new revision, with state as
+  // the snapshot that includes ops up to seq. Those ops are dropped.
+  void save_crdt(std::int64_t id, std::int64_t seq,
+                 std::string_view state, std::string_view text);
+  // Write a presence snapshot in one transaction.
+  void upsert_online_users(const std::vector<OnlineUser> &users);
+  // Run jobs in order inside one write transaction, each under its own
+  // savepoint so that a job that throws is rolled back alone. Returns each
+  // job's exception, or null; throws if the transaction fails to commit.
+  std::vector<std::exception_ptr>
+  write_batch(const std::vector<std::function<void()>> &jobs);
+
+  // Query results are streamed to a visitor, one call per row. The text it
+  // is given points into SQLite and is only valid during that call.
+  using ChatVisitor =
+      std::function<void(std::int64_t id, std::string_view content)>;
+  using DocVisitor =
+      std::function<void(std::string_view first, std::string_view second)>;
+  using DocContentVisitor =
+      std::function<void(std::string_view title, std::string_view content,
+                         std::int64_t revision)>;
+  using RevisionVisitor = std::function<void(
+      std::int64_t revision, std::int64_t time, std::int64_t length)>;
+
+  // Messages with since_id < id < before_id, oldest first. A non-negative
+  // limit keeps the oldest `limit` of them when since_id is set (catching up
+  // on new messages) and the newest `limit` otherwise (paging back).
+  void select_chats_by_workspace(const std::string &workspace,
+                                 std::int64_t since_id, std::int64_t before_id,
+                                 std::int64_t limit, const ChatVisitor &visit);
+  // Whether workspace has any message older than before_id.
+  bool has_chats_before(const std::string &workspace, std::int64_t before_id);
+  // Every stored presence entry that pinged at or after since.
+  std::vector<OnlineUser> select_online_users(std::int64_t since);
+
+  // The stored password (hash) of workspace, if it exists.
+  std::optional<std::string> select_password(std::string_view workspace);
+  // Sign workspace up; false if the name is already taken.
+  bool insert_workspace(std::string_view workspace, std::string_view password);
+  void update_password(std::string_view workspace, std::string_view password);
+
+  void insert_session(const StoredSession &session);
+  void delete_session(std::string_view token);
+  // Sessions that are still valid at now.
+  std::vector<StoredSession> select_sessions(std::int64_t now);
+  void delete_expired_sessions(std::int64_t now);
+
+  // Visits (id, title) of each doc, oldest first; every doc if date is empty.
+  void select_docs_by_workspace_and_date(const std::string &workspace,
+                                         std::string_view date,
+                                         const DocVisitor &visit);
+  // Visits (title, content, revision) with any logged edits applied; false if
+  // there is no such doc.
+  bool get_doc_by_id(const std::string &workspace, const std::string &id,
+                     const DocContentVisitor &visit);
+  // get_doc_by_id, plus the doc's stored CRDT as of the same transaction.
+  // Reads through the writer, so that inside a write batch it sees what the
+  // batch's earlier jobs wrote.
+  bool load_crdt(const std::string &workspace, std::int64_t id,
+                 const DocContentVisitor &visit, StoredCrdt &crdt);
+
+  // Revision history. Each revision a doc's content goes through is kept as
+  // a delta from the one before, with the whole content every
+  // revision_keyframe_every revisions, so rebuilding any of them applies
+  // fewer deltas than that. The history of a doc from before it was kept
+  // starts at the revision it was at.
+  //
+  // Visits (revision, time saved, length) of doc id's revisions older than
+  // before, newest first, at most limit of them.
+  void select_doc_revisions(const std::string &workspace,
+                            const std::string &id, std::int64_t before,
+                            std::int64_t limit, const RevisionVisitor &visit);
+  // Set content and time to those of doc id at revision; false if it is not
+  // in the history.
+  bool get_doc_revision(const std::string &workspace, const std::string &id,
+                        std::int64_t revision, std::string &content,
+                        std::int64_t &time);
+  static constexpr std::int64_t revision_keyframe_every = 32;
+
+  // Prepared-statement cache counters, summed over all connections.
+  std::uint64_t statement_cache_hits() const;
+  std::uint64_t statement_cache_misses() const;
+  // SQLite page cache counters, likewise, as of each connection's last
+  // lease; reading them never waits for a connection.
+  std::uint64_t page_cache_hits() const;
+  std::uint64_t page_cache_misses() const;
+
+  // Doc content at least this many bytes long is stored compressed when that
+  // saves space; 0 stores all of it as is. Either form is read back. Set it
+  // before the Database is shared.
+  void set_compress_min(std::size_t bytes) { compress_min = bytes; }
+  static constexpr std::size_t default_compress_min = 512;
 
 private:
-  sqlite3 *db = nullptr;
+  // Exclusive use of one connection for as long as the lease is alive. The
+  // lease's lifetime, including any wait for the connection, is charged to
+  // the calling thread's database time. Ending it samples the connection's
+  // page cache counters.
+  class Lease {
+  public:
+    Lease(std::unique_lock<std::recursive_mutex> lock, Connection *conn,
+          metrics::clock::time_point started)
+        : lock(std::move(lock)), conn(conn), started(started) {}
+    ~Lease() {
+      conn->sample_page_cache();
+      metrics::add_thread_db_time(metrics::clock::now() - started);
+    }
+    Connection *operator->() const { return conn; }
+    Connection &operator*() const { return *conn; }
+
+  private:
+    std::unique_lock<std::recursive_mutex> lock;
+    Connection *conn;
+    metrics::clock::time_point started;
+  };
+
+  Lease writer();
+  // Falls back to the writer when there are no read-only connections.
+  Lease reader();
+
+  std::unique_ptr<Connection> write_conn;
+  std::vector<std::unique_ptr<Connection>> read_conns;
+  std::atomic<std::size_t> next_reader{0};
+  std::size_t compress_min = default_compress_min;
 };
 
 #endif // DATABASE_HPP
@@ -0,0 +1,8 @@
+#include "db_executor.hpp"
+
+DbExecutor::DbExecutor(std::size_t threads) : pool(threads) {}
+
+DbExecutor::~DbExecutor() {
+  pool.stop();
+  pool.join();
+}
@@ -0,0 +1,49 @@
+#ifndef DB_EXECUTOR_HPP
+#define DB_EXECUTOR_HPP
+
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <exception>
+#include <utility>
+
+namespace net = boost::asio;
+
+// Worker pool for blocking Database calls, so that a slow query or commit
+// never holds up the threads that accept, read and write connections.
+class DbExecutor {
+public:
+  explicit DbExecutor(std::size_t threads);
+  ~DbExecutor();
+
+  DbExecutor(const DbExecutor &) = delete;
+  DbExecutor &operator=(const DbExecutor &) = delete;
+
+  // Run fn on a DB worker, then complete with void(std::exception_ptr) on the
+  // executor associated with token. Any Asio completion token works, e.g. a
+  // handler bound to a connection's strand or net::use_future.
+  template <class Function, class CompletionToken>
+  auto async_run(Function fn, CompletionToken &&token) {
+    return net::async_initiate<CompletionToken, void(std::exception_ptr)>(
+        [this](auto handler, Function fn) {
+          net::post(pool, [fn = std::move(fn),
+                           handler = std::move(handler)]() mutable {
+            std::exception_ptr error;
+            try {
+              fn();
+            } catch (...) {
+              error = std::current_exception();
+            }
+            auto ex = net::get_associated_executor(handler);
+            net::post(ex, [handler = std::move(handler), error]() mutable {
+              handler(error);
+            });
+          });
+        },
+        token, std::move(fn));
+  }
+
+private:
+  net::thread_pool pool;
+};
+
+#endif // DB_EXECUTOR_HPP
@@ -0,0 +1,211 @@
+#include "delta.hpp"
+#include "byte_io.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+// The source is indexed by the 8-byte block at every multiple of block, and
+// the target looked up at every byte, so every match of at least
+// 2 * block - 1 bytes is found. Copies shorter than min_copy are not worth
+// their instruction.
+constexpr std::size_t block = 8;
+constexpr std::size_t min_copy = 16;
+
+std::uint64_t get_varint(std::string_view &in) {
+  std::uint64_t value;
+  if (!::get_varint(in, value))
+    throw std::runtime_error("Malformed revision delta");
+  return value;
+}
+
+std::size_t hash(std::uint64_t value, unsigned bits) {
+  return static_cast<std::size_t>((value * 0x9e3779b97f4a7c15ull) >>
+                                  (64 - bits));
+}
+
+// Writes instructions, joining each to the one before where they continue
+// each other.
+class DeltaWriter {
+public:
+  DeltaWriter(std::string &out, std::size_t size) : out(out) {
+    put_varint(out, size);
+  }
+  ~DeltaWriter() { flush(); }
+
+  void insert(std::string_view text) {
+    if (copy_length)
+      flush();
+    pending.append(text);
+  }
+
+  void copy(std::size_t offset, std::size_t length) {
+    if (!length)
+      return;
+    if (copy_length && copy_offset + copy_length == offset) {
+      copy_length += length;
+      return;
+    }
+    flush();
+    copy_offset = offset;
+    copy_length = length;
+  }
+
+private:
+  void flush() {
+    if (copy_length) {
+      put_varint(out, copy_length << 1 | 1);
+      put_varint(out, copy_offset);
+      copy_length = 0;
+    } else if (!pending.empty()) {
+      put_varint(out, pending.size() << 1);
+      out += pending;
+      pending.clear();
+    }
+  }
+
+  std::string &out;
+  std::string pending; // inserted text not yet written
+  std::size_t copy_offset = 0;
+  std::size_t copy_length = 0;
+};
+
+// Part of a doc being edited: length bytes of the original from offset on,
+// or inserted text.
+struct Piece {
+  std::string_view text;
+  std::size_t offset = 0;
+  std::size_t length = 0;
+};
+
+// Index of the piece that starts pos bytes in, splitting one if need be.
+std::size_t split(std::vector<Piece> &pieces, std::size_t pos) {
+  std::size_t i = 0;
+  for (; i < pieces.size() && pos >= pieces[i].length; ++i)
+    pos -= pieces[i].length;
+  if (i == pieces.size() || pos == 0)
+    return i;
+  auto tail = pieces[i];
+  tail.length -= pos;
+  if (tail.text.empty())
+    tail.offset += pos;
+  else
+    tail.text.remove_prefix(pos);
+  pieces[i].length = pos;
+  pieces[i].text = pieces[i].text.substr(0, pos);
+  pieces.insert(pieces.begin() + static_cast<std::ptrdiff_t>(i) + 1, tail);
+  return i + 1;
+}
+
+} // namespace
+
+void make_delta(std::string_view source, std::string_view target,
+                std::string &out) {
+  DeltaWriter writer(out, target.size());
+  // Most saves change one stretch of the doc; the rest is copied as is.
+  auto shorter = std::min(source.size(), target.size());
+  auto prefix =
+      common_length(source.data(), target.data(), target.data() + shorter);
+  std::size_t suffix = 0;
+  while (suffix < shorter - prefix &&
+         source[source.size() - suffix - 1] ==
+             target[target.size() - suffix - 1])
+    ++suffix;
+  writer.copy(0, prefix);
+
+  auto end = target.size() - suffix;
+  std::size_t literal = prefix; // start of the bytes not yet written
+  if (end - prefix >= min_copy && source.size() >= block &&
+      source.size() <= UINT32_MAX) {
+    unsigned bits = 10;
+    while ((std::size_t(1) << bits) < source.size() / block * 2 && bits < 24)
+      ++bits;
+    std::vector<std::uint32_t> table(std::size_t(1) << bits); // offset + 1
+    for (std::size_t p = 0; p + block <= source.size(); p += block)
+      table[hash(load64(source.data() + p), bits)] =
+          static_cast<std::uint32_t>(p + 1);
+
+    std::size_t at = prefix;
+    while (at + block <= end) {
+      auto candidate = table[hash(load64(target.data() + at), bits)];
+      if (!candidate ||
+          load64(source.data() + candidate - 1) != load64(target.data() + at)) {
+        ++at;
+        continue;
+      }
+      std::size_t from = candidate - 1;
+      std::size_t back = 0;
+      while (at - back > literal && from - back > 0 &&
+             source[from - back - 1] == target[at - back - 1])
+        ++back;
+      auto limit = std::min(end, at + source.size() - from);
+      auto length = back + block +
+                    common_length(source.data() + from + block,
+                                  target.data() + at + block,
+                                  target.data() + limit);
+      if (length < min_copy) {
+        ++at;
+        continue;
+      }
+      writer.insert(target.substr(literal, at - back - literal));
+      writer.copy(from - back, length);
+      at += length - back;
+      literal = at;
+    }
+  }
+  writer.insert(target.substr(literal, end - literal));
+  writer.copy(source.size() - suffix, suffix);
+}
+
+void make_delta(const std::vector<DocOp> &ops, std::size_t length,
+                std::string &out) {
+  std::vector<Piece> pieces;
+  if (length)
+    pieces.push_back({{}, 0, length});
+  for (const auto &op : ops) {
+    auto first = split(pieces, op.at);
+    auto last = split(pieces, op.at + op.erase);
+    pieces.erase(pieces.begin() + static_cast<std::ptrdiff_t>(first),
+                 pieces.begin() + static_cast<std::ptrdiff_t>(last));
+    if (!op.insert.empty())
+      pieces.insert(pieces.begin() + static_cast<std::ptrdiff_t>(first),
+                    {op.insert, 0, op.insert.size()});
+    length = length - op.erase + op.insert.size();
+  }
+  DeltaWriter writer(out, length);
+  for (const auto &piece : pieces) {
+    if (piece.text.empty())
+      writer.copy(piece.offset, piece.length);
+    else
+      writer.insert(piece.text);
+  }
+}
+
+void apply_delta(std::string_view source, std::string_view delta,
+                 std::string &out) {
+  auto size = get_varint(delta);
+  if (size > out.max_size())
+    throw std::runtime_error("Malformed revision delta");
+  out.clear();
+  out.reserve(static_cast<std::size_t>(size));
+  while (!delta.empty()) {
+    auto instruction = get_varint(delta);
+    auto length = instruction >> 1;
+    if (length > size - out.size())
+      throw std::runtime_error("Malformed revision delta");
+    if (instruction & 1) {
+      auto offset = get_varint(delta);
+      if (offset > source.size() || length > source.size() - offset)
+        throw std::runtime_error("Malformed revision delta");
+      out.append(source.substr(offset, length));
+    } else {
+      if (length > delta.size())
+        throw std::runtime_error("Malformed revision delta");
+      out.append(delta.substr(0, length));
+      delta.remove_prefix(length);
+    }
+  }
+  if (out.size() != size)
+    throw std::runtime_error("Malformed revision delta");
+}
@@ -0,0 +1,30 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include "doc_ops.hpp"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary deltas between two versions of a doc's content, as revision history
+// stores them. A delta is the target's size as a varint followed by
+// instructions, each a varint n: n >> 1 bytes are inserted from the bytes
+// that follow when n is even, or copied from the source at the varint offset
+// that follows when n is odd.
+
+// Append to out the delta that turns source into target.
+void make_delta(std::string_view source, std::string_view target,
+                std::string &out);
+
+// Append to out the delta that ops make to a doc of length bytes, without
+// needing the doc itself. The ops must fit it, as apply_length checks.
+void make_delta(const std::vector<DocOp> &ops, std::size_t length,
+                std::string &out);
+
+// Set out to source with delta applied. Throws std::runtime_error if delta
+// is malformed or does not fit source.
+void apply_delta(std::string_view source, std::string_view delta,
+                 std::string &out);
+
+#endif // DELTA_HPP
@@ -0,0 +1,87 @@
+#include "doc_ops.hpp"
+#include "byte_io.hpp"
+#include <stdexcept>
+
+namespace {
+
+std::uint64_t get_varint(std::string_view &in) {
+  std::uint64_t value;
+  if (!::get_varint(in, value))
+    throw std::runtime_error("Malformed document op log");
+  return value;
+}
+
+bool get_size(const boost::json::object &obj, std::string_view key,
+              std::size_t &value) {
+  auto field = obj.if_contains(key);
+  if (!field)
+    return true;
+  if (!field->is_int64() || field->as_int64() < 0)
+    return false;
+  value = static_cast<std::size_t>(field->as_int64());
+  return true;
+}
+
+} // namespace
+
+bool parse_doc_edit(const boost::json::value &jv, std::int64_t &base,
+                    std::vector<DocOp> &ops) {
+  auto obj = jv.if_object();
+  if (!obj)
+    return false;
+  auto base_field = obj->if_contains("base");
+  auto ops_field = obj->if_contains("ops");
+  if (!base_field || !base_field->is_int64() || !ops_field ||
+      !ops_field->is_array())
+    return false;
+  base = base_field->as_int64();
+
+  ops.clear();
+  for (const auto &item : ops_field->as_array()) {
+    auto op_obj = item.if_object();
+    if (!op_obj || !op_obj->if_contains("at"))
+      return false;
+    DocOp op;
+    if (!get_size(*op_obj, "at", op.at) ||
+        !get_size(*op_obj, "delete", op.erase))
+      return false;
+    if (auto insert = op_obj->if_contains("insert")) {
+      if (!insert->is_string())
+        return false;
+      op.insert = insert->as_string();
+    }
+    ops.push_back(op);
+  }
+  return !ops.empty();
+}
+
+bool apply_length(const std::vector<DocOp> &ops, std::size_t &length) {
+  for (const auto &op : ops) {
+    if (op.at > length || op.erase > length - op.at)
+      return false;
+    length = length - op.erase + op.insert.size();
+  }
+  return true;
+}
+
+void encode_doc_ops(const std::vector<DocOp> &ops, std::string &out) {
+  for (const auto &op : ops) {
+    put_varint(out, op.at);
+    put_varint(out, op.erase);
+    put_varint(out, op.insert.size());
+    out += op.insert;
+  }
+}
+
+void apply_doc_ops(std::string_view encoded, std::string &content) {
+  while (!encoded.empty()) {
+    auto at = get_varint(encoded);
+    auto erase = get_varint(encoded);
+    auto size = get_varint(encoded);
+    if (size > encoded.size() || at > content.size() ||
+        erase > content.size() - at)
+      throw std::runtime_error("Document op log does not fit the content");
+    content.replace(at, erase, encoded.substr(0, size));
+    encoded.remove_prefix(size);
+  }
+}
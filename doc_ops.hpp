@@ -0,0 +1,39 @@
+#ifndef DOC_OPS_HPP
+#define DOC_OPS_HPP
+
+#include <boost/json.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One edit to a document's content: at byte offset at, remove erase bytes,
+// then insert text there. A list of them is applied in order, each to the
+// result of the ones before. Offsets are into the UTF-8 content, so clients
+// must keep them on character boundaries.
+struct DocOp {
+  std::size_t at = 0;
+  std::size_t erase = 0;
+  std::string_view insert; // points into the request or an encoded log entry
+};
+
+// Parse an edit request, {"base": 7, "ops": [{"at": 0, "delete": 3,
+// "insert": "abc"}, ...]}. "delete" and "insert" are each optional. Returns
+// false if the body does not have that shape.
+bool parse_doc_edit(const boost::json::value &jv, std::int64_t &base,
+                    std::vector<DocOp> &ops);
+
+// Check that ops fit a document of length bytes and set length to what it is
+// after them; false if an op reaches past the end.
+bool apply_length(const std::vector<DocOp> &ops, std::size_t &length);
+
+// The compact form ops are logged in: per op the varints at, erase and
+// insert's size, followed by insert's bytes.
+void encode_doc_ops(const std::vector<DocOp> &ops, std::string &out);
+
+// Apply logged ops to content. Throws std::runtime_error if encoded is
+// malformed or does not fit content.
+void apply_doc_ops(std::string_view encoded, std::string &content);
+
+#endif // DOC_OPS_HPP
@@ -0,0 +1,72 @@
+#include "doc_session.hpp"
+
+doc_session::doc_session(tcp::socket socket, LiveDocs *docs,
+                         std::int64_t doc_id, std::string workspace)
+    : ws_(std::move(socket)), docs_(docs), doc_id_(doc_id),
+      workspace_(std::move(workspace)) {}
+
+doc_session::~doc_session() { docs_->leave(doc_id_, this); }
+
+void doc_session::on_accept(beast::error_code ec) {
+  if (ec)
+    return;
+  ws_.set_option(
+      websocket::stream_base::timeout::suggested(beast::role_type::server));
+  ws_.read_message_max(max_message);
+  docs_->join(doc_id_, workspace_, shared_from_this());
+  read();
+}
+
+void doc_session::read() {
+  auto self = shared_from_this();
+  ws_.async_read(buffer_, [self](beast::error_code ec, std::size_t) {
+    if (ec)
+      return; // closed; LiveDocs forgets us when the last reference goes
+    auto data = self->buffer_.data();
+    std::string_view message(static_cast<const char *>(data.data()),
+                             data.size());
+    if (!self->docs_->apply(self->doc_id_, self.get(), message)) {
+      beast::error_code ignored;
+      beast::get_lowest_layer(self->ws_).close(ignored);
+      return;
+    }
+    self->buffer_.consume(self->buffer_.size());
+    self->read();
+  });
+}
+
+void doc_session::send(std::shared_ptr<const std::string> message) {
+  auto self = shared_from_this();
+  net::post(ws_.get_executor(), [self, message = std::move(message)] {
+    if (self->queue_.size() >= max_queue) {
+      // Closing makes the pending read fail, which releases the session.
+      beast::error_code ec;
+      beast::get_lowest_layer(self->ws_).close(ec);
+      return;
+    }
+    self->queue_.push_back(message);
+    if (self->queue_.size() == 1)
+      self->write();
+  });
+}
+
+void doc_session::close() {
+  auto self = shared_from_this();
+  net::post(ws_.get_executor(), [self] {
+    beast::error_code ec;
+    beast::get_lowest_layer(self->ws_).close(ec);
+  });
+}
+
+void doc_session::write() {
+  auto self = shared_from_this();
+  ws_.text(true);
+  ws_.async_write(net::buffer(*queue_.front()),
+                  [self](beast::error_code ec, std::size_t) {
+                    if (ec)
+                      return;
+                    self->queue_.pop_front();
+                    if (!self->queue_.empty())
+                      self->write();
+                  });
+}
@@ -0,0 +1,60 @@
+#ifndef DOC_SESSION_HPP
+#define DOC_SESSION_HPP
+
+#include "live_docs.hpp"
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <boost/beast/websocket.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+
+// A WebSocket editor of one live doc. Every frame it reads is an op for
+// LiveDocs to merge; a frame that is rejected ends the session. The ops of
+// the other editors are pushed to it the same way chat messages are pushed
+// to a websocket_session.
+class doc_session : public std::enable_shared_from_this<doc_session> {
+public:
+  doc_session(tcp::socket socket, LiveDocs *docs, std::int64_t doc_id,
+              std::string workspace);
+  ~doc_session();
+
+  // Complete the WebSocket handshake answering req, then join the doc.
+  template <class Body, class Allocator>
+  void start(http::request<Body, http::basic_fields<Allocator>> req) {
+    auto self = shared_from_this();
+    ws_.async_accept(req,
+                     [self](beast::error_code ec) { self->on_accept(ec); });
+  }
+
+  // Queue a text frame. Safe to call from any thread.
+  void send(std::shared_ptr<const std::string> message);
+
+  // Drop the connection. Safe to call from any thread.
+  void close();
+
+private:
+  // An editor this far behind is dropped instead of buffering forever.
+  static constexpr std::size_t max_queue = 1024;
+  // Largest op accepted in one frame.
+  static constexpr std::size_t max_message = 1 << 20;
+
+  websocket::stream<tcp::socket> ws_;
+  LiveDocs *docs_;
+  std::int64_t doc_id_;
+  std::string workspace_; // the editor's, which the doc must be in
+  beast::flat_buffer buffer_;
+  std::deque<std::shared_ptr<const std::string>> queue_;
+
+  void on_accept(beast::error_code ec);
+  void read();
+  void write();
+};
+
+#endif // DOC_SESSION_HPP
@@ -23,6 +23,19 @@ void tag_invoke(boost::json::value_from_tag, boost::json::value &jv,
   jv = std::move(obj);
 }
 
+DocumentView document_view(const boost::json::value &jv) {
+  const auto &obj = jv.as_object();
+
+  DocumentView doc;
+  if (auto date = obj.if_contains("date"))
+    doc.date = date->as_string();
+  if (auto title = obj.if_contains("title"))
+    doc.title = title->as_string();
+  if (auto content = obj.if_contains("content"))
+    doc.content = content->as_string();
+  return doc;
+}
+
 // Deserialization (JSON -> object)
 Document tag_invoke(boost::json::value_to_tag<Document>,
                     const boost::json::value &jv) {
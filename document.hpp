@@ -3,6 +3,7 @@
 
 #include <boost/json.hpp>
 #include <string>
+#include <string_view>
 
 class Document {
 public:
@@ -18,4 +19,12 @@ public:
                              const boost::json::value &jv);
 };
 
+// The fields of a document in a parsed request, pointing into the JSON value
+// instead of copying out of it. Only valid while that value is.
+struct DocumentView {
+  std::string_view date, title, content;
+};
+
+DocumentView document_view(const boost::json::value &jv);
+
 #endif // DOCUMENT_HPP
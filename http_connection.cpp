@@ -1,16 +1,29 @@
 #include "http_connection.hpp"
-#include "base64.hpp"
+#include "doc_session.hpp"
 #include "document.hpp"
+#include "json_writer.hpp"
+#include "logger.hpp"
 #include "loginrequest.hpp"
+#include "metrics.hpp"
+#include "websocket_session.hpp"
 #include <boost/beast/http.hpp>
 #include <boost/json.hpp>
 #include <boost/json/fwd.hpp>
 #include <boost/json/value_from.hpp>
+#include <boost/url/parse.hpp>
+#include <charconv>
 #include <database.hpp>
-#include <iostream>
+#include <limits>
+#include <stdexcept>
 
-http_connection::http_connection(tcp::socket socket, Database *db)
-    : db(db), socket_(std::move(socket)) {}
+http_connection::http_connection(tcp::socket socket,
+                                 const ServerContext &context)
+    : db(context.db), db_executor(context.db_executor),
+      write_batcher(context.write_batcher), chat_hub(context.chat_hub),
+      presence(context.presence), sessions(context.sessions),
+      password_hasher(context.password_hasher),
+      live_docs(context.live_docs), versions(context.versions),
+      socket_(std::move(socket)) {}
 
 void http_connection::start() {
   read_request();
@@ -19,152 +32,784 @@ void http_connection::start() {
 
 void http_connection::read_request() {
   auto self = shared_from_this();
+  deadline_.expires_after(idle_timeout);
 
+  // Any pipelined requests that arrived with the previous one are already in
+  // buffer_, so they are parsed without waiting on the socket.
   http::async_read(socket_, buffer_, request_,
                    [self](beast::error_code ec, std::size_t bytes_transferred) {
                      boost::ignore_unused(bytes_transferred);
                      if (!ec)
                        self->router();
+                     else
+                       self->close();
                    });
 }
 
+// A doc id as it appears in a path. Only the canonical spelling is taken, so
+// that one doc is never open live under two names.
+static bool parse_doc_id(std::string_view text, std::int64_t &id) {
+  if (text.empty() || text[0] < '1' || text[0] > '9')
+    return false;
+  auto end = text.data() + text.size();
+  auto parsed = std::from_chars(text.data(), end, id);
+  return parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+// A query parameter's value as a decimal integer. Throws
+// std::invalid_argument if that is not all it is or it does not fit.
+static std::int64_t int_param(std::string_view text) {
+  std::int64_t value = 0;
+  auto end = text.data() + text.size();
+  auto parsed = std::from_chars(text.data(), end, value);
+  if (parsed.ec != std::errc() || parsed.ptr != end)
+    throw std::invalid_argument("not an integer");
+  return value;
+}
+
 void http_connection::router() {
+  request_started_ = metrics::clock::now();
   response_.version(request_.version());
-  response_.keep_alive(false);
+  response_.keep_alive(request_.keep_alive());
   response_.result(http::status::ok);
   // Parse request values
   auto auth_header = request_.find(http::field::authorization);
-  std::string workspace;
-  if (auth_header != request_.end()) {
-    workspace = Base64::decode(auth_header->value());
-    std::cerr << "Workspace : " << workspace << '\n';
+  has_workspace_ = auth_header != request_.end() &&
+                   authenticate(auth_header->value());
+  auto target = request_.target();
+  // Routes match on the path; handlers read the query string themselves.
+  auto path = target.substr(0, target.find('?'));
+  size_t last_slash_pos = path.rfind('/');
+  last_segment_.assign(path.substr(last_slash_pos + 1));
+  // The previous request's value lives in the arena; let go of both.
+  json_value_ = nullptr;
+  json_arena_.release();
+  body_ = request_.body();
+  if (!body_.empty()) {
+    boost::system::error_code ec;
+    json_parser_.reset(&json_arena_);
+    json_parser_.write(body_, ec);
+    // Not every body is JSON; those handlers use body_ as is.
+    if (!ec)
+      json_value_ = json_parser_.release();
+  }
+  // Login bodies carry a password, so only their size is logged. Whatever
+  // the client chose is escaped.
+  if (has_workspace_ && path == "/login")
+    logging::info(request_.method_string(), ' ', logging::escape(target),
+                  " workspace=", logging::escape(workspace_), " (",
+                  body_.size(), " bytes)");
+  else if (has_workspace_)
+    logging::info(request_.method_string(), ' ', logging::escape(target),
+                  " workspace=", logging::escape(workspace_),
+                  " body=", logging::excerpt(body_), " (", body_.size(),
+                  " bytes)");
+  else
+    logging::info(request_.method_string(), ' ', logging::escape(target),
+                  " without authorization");
+
+  if (websocket::is_upgrade(request_)) {
+    if (path == "/chat/ws") {
+      upgrade_to_websocket();
+      return;
+    }
+    // /docs/{id}/ws
+    std::int64_t doc_id = 0;
+    if (path.size() > 9 && path.starts_with("/docs/") &&
+        path.ends_with("/ws") &&
+        parse_doc_id(path.substr(6, path.size() - 9), doc_id)) {
+      upgrade_to_websocket(doc_id);
+      return;
+    }
+  }
+
+  // /docs/{id}. A path whose id is not a doc id matches no route, so it is
+  // answered 404 before it takes a worker or a write batch slot.
+  bool new_doc = path == "/docs" || path == "/docs/";
+  bool one_doc =
+      path.starts_with("/docs/") && parse_doc_id(path.substr(6), path_doc_);
+
+  // /docs/{id}/revisions, and /docs/{id}/revisions/{revision} for one.
+  auto digits = [](auto text) {
+    return !text.empty() && text.find_first_not_of("0123456789") == text.npos;
+  };
+  bool revisions = false;
+  bool one_revision = false;
+  auto revisions_at = path.find("/revisions");
+  if (path.starts_with("/docs/") && revisions_at != path.npos) {
+    auto id = path.substr(6, revisions_at - 6);
+    auto rest = path.substr(revisions_at + 10);
+    one_revision = !rest.empty();
+    revisions = parse_doc_id(id, path_doc_) &&
+                (!one_revision ||
+                 (rest.starts_with("/") && digits(rest.substr(1))));
+    doc_id_.assign(id.data(), id.size());
+  }
+
+  route_handler route = nullptr;
+  Dispatch dispatch = Dispatch::db_pool;
+  route_id_ = metrics::Route::not_found;
+  auto match = [&](route_handler handler, metrics::Route id,
+                   Dispatch where = Dispatch::db_pool) {
+    route = handler;
+    route_id_ = id;
+    dispatch = where;
+  };
+  auto method = request_.method();
+  if (method == http::verb::post && path == "/login") // Login
+    match(&http_connection::login, metrics::Route::login,
+          Dispatch::hash_pool);
+  else if (method == http::verb::post && path == "/logout") // End session
+    match(&http_connection::logout, metrics::Route::logout,
+          Dispatch::write_batch);
+  else if (method == http::verb::get && path == "/chat") // Get chat messages
+    match(&http_connection::get_chat, metrics::Route::get_chat);
+  else if (method == http::verb::get && path == "/docs") // Get list of docs
+    match(&http_connection::list_docs, metrics::Route::list_docs);
+  else if (method == http::verb::post && path == "/chat") // Send chat message
+    match(&http_connection::post_chat, metrics::Route::post_chat,
+          Dispatch::write_batch);
+  else if (method == http::verb::post && (new_doc || one_doc))
+    match(&http_connection::save_doc, metrics::Route::save_doc,
+          Dispatch::write_batch);
+  else if (method == http::verb::patch &&
+           one_doc) // Apply edit ops to a document
+    match(&http_connection::edit_doc, metrics::Route::edit_doc,
+          Dispatch::write_batch);
+  else if (method == http::verb::post && path == "/ping")
+    match(&http_connection::ping, metrics::Route::ping, Dispatch::strand);
+  else if (method == http::verb::post &&
+           path == "/online_users") // Get list of online users
+    match(&http_connection::online_users, metrics::Route::online_users,
+          Dispatch::strand);
+  else if (method == http::verb::get && path == "/metrics")
+    match(&http_connection::get_metrics, metrics::Route::metrics,
+          Dispatch::strand);
+  else if (method == http::verb::get && revisions && one_revision)
+    match(&http_connection::get_revision, metrics::Route::get_revision);
+  else if (method == http::verb::get && revisions) // History of a document
+    match(&http_connection::list_revisions, metrics::Route::list_revisions);
+  else if (method == http::verb::get && one_doc) // Get single document
+    match(&http_connection::get_doc, metrics::Route::get_doc);
+  else if (method == http::verb::delete_ &&
+           one_doc) // Delete single document
+    match(&http_connection::delete_doc, metrics::Route::delete_doc,
+          Dispatch::write_batch);
+  metrics::record(route_id_, metrics::Phase::parse,
+                  metrics::clock::now() - request_started_);
+
+  if (!route) { // Invalid request
+    response_.result(http::status::not_found);
+    response_.set(http::field::content_type, "text/plain");
+    response_.body() = "Not found\r\n";
+    write_response();
+    return;
+  }
+
+  // Every other route acts for the caller's workspace.
+  if (!has_workspace_ && route_id_ != metrics::Route::login &&
+      route_id_ != metrics::Route::metrics) {
+    response_.result(http::status::unauthorized);
+    write_response();
+    return;
+  }
+
+  if (not_modified()) { // The client's copy is current
+    write_response();
+    return;
+  }
+
+  if (dispatch == Dispatch::strand) { // Answer straight from the strand
+    run_handler(route);
+    write_response();
+    return;
+  }
+
+  // Run the handler off the strand and come back to it to send the response.
+  // Nothing else touches request_ or response_ while the handler runs.
+  auto self = shared_from_this();
+  auto handler = [self, route] { self->run_handler(route); };
+  auto done = net::bind_executor(
+      socket_.get_executor(),
+      [self](std::exception_ptr error) { self->finish_handler(error); });
+  if (dispatch == Dispatch::write_batch)
+    write_batcher->async_run(std::move(handler), std::move(done));
+  else if (dispatch == Dispatch::hash_pool)
+    password_hasher->async_run(std::move(handler), std::move(done));
+  else
+    db_executor->async_run(std::move(handler), std::move(done));
+}
+
+void http_connection::finish_handler(std::exception_ptr error) {
+  // Bumped even if the write failed; that only costs a full response.
+  if (changed_doc_)
+    versions->bump_doc(*changed_doc_);
+  changed_doc_.reset();
+  if (error) {
+    auto status = http::status::internal_server_error;
+    try {
+      std::rethrow_exception(error);
+    } catch (const PasswordHasher::Overloaded &e) {
+      logging::warning(request_.method_string(), ' ',
+                       logging::escape(request_.target()), " rejected: ",
+                       e.what());
+      status = http::status::service_unavailable;
+      response_.set(http::field::retry_after, "1");
+    } catch (const std::exception &e) {
+      logging::error(request_.method_string(), ' ',
+                     logging::escape(request_.target()), " failed: ",
+                     e.what());
+    }
+    if (streaming_) { // Too late for a status code; cut the response off.
+      chunks_.cancel();
+      write_chunks();
+      return;
+    }
+    response_.result(status);
+  } else if (!pending_broadcast_.empty()) {
+    versions->bump_chat(workspace_);
+    chat_hub->broadcast(workspace_, std::move(pending_broadcast_));
+  }
+  pending_broadcast_.clear();
+  if (streaming_) {
+    chunks_.finish(std::move(response_.body()));
+    write_chunks();
+    return;
+  }
+  write_response();
+}
+
+bool http_connection::not_modified() {
+  etag_.clear();
+  if (route_id_ == metrics::Route::get_doc) {
+    etag_ = versions->doc_etag(path_doc_);
+  } else if (route_id_ == metrics::Route::get_chat && has_workspace_) {
+    etag_ = versions->chat_etag(workspace_);
   } else {
-    std::cerr << "Authorization header not found\n";
+    return false;
+  }
+  auto if_none_match = request_.find(http::field::if_none_match);
+  if (if_none_match == request_.end() ||
+      !ContentVersions::matches(if_none_match->value(), etag_))
+    return false;
+  metrics::increment(metrics::Counter::not_modified);
+  response_.result(http::status::not_modified);
+  response_.set(http::field::etag, etag_);
+  return true;
+}
+
+// The token part of an Authorization value; the "Bearer " scheme is optional.
+static std::string_view session_token(std::string_view credentials) {
+  constexpr std::string_view scheme = "Bearer ";
+  if (credentials.substr(0, scheme.size()) == scheme)
+    credentials.remove_prefix(scheme.size());
+  return credentials;
+}
+
+bool http_connection::authenticate(std::string_view credentials) {
+  if (sessions->find(session_token(credentials), workspace_))
+    return true;
+  workspace_.clear(); // treated like a missing token
+  return false;
+}
+
+void http_connection::run_handler(route_handler route) {
+  auto db_before = metrics::thread_db_time();
+  auto hash_before = metrics::thread_hash_time();
+  auto started = metrics::clock::now();
+  (this->*route)();
+  auto db_time = metrics::thread_db_time() - db_before;
+  auto hash_time = metrics::thread_hash_time() - hash_before;
+  metrics::record(route_id_, metrics::Phase::db, db_time);
+  if (hash_time.count())
+    metrics::record(route_id_, metrics::Phase::hash, hash_time);
+  metrics::record(route_id_, metrics::Phase::serialize,
+                  metrics::clock::now() - started - db_time - hash_time);
+}
+
+void http_connection::upgrade_to_websocket(
+    std::optional<std::int64_t> doc_id) {
+  // Browsers cannot set headers on a WebSocket handshake, so the token may
+  // also arrive as ?token=.
+  if (!has_workspace_) {
+    auto url = boost::urls::parse_origin_form(request_.target());
+    if (url) {
+      auto token = url->params().find("token");
+      if (token != url->params().end()) {
+        has_workspace_ = authenticate((*token).value);
+      }
+    }
+  }
+  if (!has_workspace_) {
+    response_.result(http::status::unauthorized);
+    write_response();
+    return;
+  }
+
+  // The session owns the socket from here on; stop this connection's timer.
+  deadline_.cancel();
+  metrics::increment(metrics::Counter::websocket_upgrades);
+  if (doc_id)
+    std::make_shared<doc_session>(std::move(socket_), live_docs, *doc_id,
+                                  workspace_)
+        ->start(std::move(request_));
+  else
+    std::make_shared<websocket_session>(std::move(socket_), chat_hub,
+                                        workspace_)
+        ->start(std::move(request_));
+}
+
+void http_connection::login() {
+  auto login_request =
+      LoginRequest(boost::json::value_to<LoginRequest>(json_value_));
+  const auto &id = login_request.id;
+  const auto &password = login_request.password;
+  auto stored = db->select_password(id);
+  // Sign up. If the same name was signed up in the meantime, check the
+  // password against that account instead.
+  if (!stored && !db->insert_workspace(id, password_hasher->hash(password)))
+    stored = db->select_password(id);
+  if (stored) {
+    if (!password_hasher->verify(password, *stored)) {
+      response_.result(http::status::unauthorized);
+      return;
+    }
+    if (password_hasher->needs_rehash(*stored))
+      db->update_password(id, password_hasher->hash(password));
   }
-  size_t last_slash_pos = request_.target().rfind('/');
-  std::string last_segment = request_.target().substr(last_slash_pos + 1);
-  std::string body_str;
-  boost::json::value json_value;
+  // Stored before the token is valid or handed out, so that it survives a
+  // restart and a failed insert leaves no session behind.
+  auto session = sessions->create(id);
+  db->insert_session(session);
+  sessions->add(session);
+  response_.set(http::field::content_type, "text/plain");
+  response_.body() = session.token;
+}
+
+void http_connection::logout() {
+  auto auth_header = request_.find(http::field::authorization);
+  if (!has_workspace_ || auth_header == request_.end()) {
+    response_.result(http::status::unauthorized);
+    return;
+  }
+  // Revoked in memory first, so the token stops working straight away.
+  auto token = session_token(auth_header->value());
+  sessions->revoke(token);
+  db->delete_session(token);
+}
+
+void http_connection::get_chat() {
+  // Optional cursor parameters: since_id returns messages newer than the
+  // given id (what polling clients send), before_id pages back through
+  // history, and limit caps the page size. Without any of them the whole
+  // history is returned.
+  std::int64_t since_id = 0;
+  std::int64_t before_id = std::numeric_limits<std::int64_t>::max();
+  std::int64_t limit = -1;
+  auto url = boost::urls::parse_origin_form(request_.target());
   try {
-    body_str = boost::beast::buffers_to_string(request_.body().data());
-    json_value = boost::json::parse(body_str);
-  } catch (std::runtime_error &e) {
-    // Ignore error
+    if (!url)
+      throw std::invalid_argument("malformed target");
+    for (auto param : url->params()) {
+      if (param.key == "since_id")
+        since_id = int_param(param.value);
+      else if (param.key == "before_id")
+        before_id = int_param(param.value);
+      else if (param.key == "limit")
+        limit = std::min(int_param(param.value), max_chat_page);
+    }
+    if (limit == 0 || limit < -1)
+      throw std::invalid_argument("limit must be positive");
+  } catch (const std::logic_error &) {
+    response_.result(http::status::bad_request);
+    return;
   }
-  std::cerr << request_.method() << ' ' << request_.target() << '\n';
-  std::cerr << "Body :" << body_str << '\n';
 
+  // Rows are written into the response as SQLite returns them.
+  response_.set(http::field::content_type, "application/json");
+  if (!etag_.empty())
+    response_.set(http::field::etag, etag_);
+  JsonWriter json(response_.body());
+  json.begin_object();
+  json.key("list");
+  json.begin_array();
+  std::int64_t first_id = 0, last_id = 0, written = 0;
+  bool has_more = false;
+  bool newest_page = since_id <= 0 && limit >= 0;
+  // A page after since_id asks for one extra row to learn whether another
+  // page follows; the newest page checks for older rows afterwards.
+  db->select_chats_by_workspace(
+      workspace_, since_id, before_id,
+      limit < 0 || newest_page ? limit : limit + 1,
+      [&](std::int64_t id, std::string_view content) {
+        if (limit >= 0 && written == limit) {
+          has_more = true;
+          return;
+        }
+        if (!written++)
+          first_id = id;
+        last_id = id;
+        json.string(content);
+        flush_chunk();
+      });
+  if (newest_page && written)
+    has_more = db->has_chats_before(workspace_, first_id);
+  json.end_array();
+  json.key("first_id");
+  json.number(first_id);
+  // Clients poll with since_id=last_id; keep their cursor when nothing is new.
+  json.key("last_id");
+  json.number(written ? last_id : since_id);
+  json.key("has_more");
+  json.boolean(has_more);
+  json.end_object();
+}
+
+void http_connection::list_docs() {
+  response_.set(http::field::content_type, "application/json");
+  JsonWriter json(response_.body());
+  json.begin_object();
+  json.key("list");
+  json.begin_array();
+  db->select_docs_by_workspace_and_date(
+      workspace_, body_, [&](std::string_view id, std::string_view title) {
+        json.begin_object();
+        json.key("id");
+        json.string(id);
+        json.key("title");
+        json.string(title);
+        json.end_object();
+        flush_chunk();
+      });
+  json.end_array();
+  json.end_object();
+}
+
+void http_connection::post_chat() {
+  auto id = db->insert_chat(workspace_, body_);
+  // Same shape as a GET /chat entry plus its cursor.
+  JsonWriter json(pending_broadcast_);
+  json.begin_object();
+  json.key("id");
+  json.number(id);
+  json.key("content");
+  json.string(body_);
+  json.end_object();
+}
+
+void http_connection::save_doc() {
+  auto doc = document_view(json_value_);
+  if (last_segment_ == "" || last_segment_ == "docs") {
+    // Its id may have been a deleted doc's, which clients could have polled.
+    changed_doc_ = db->insert_doc(workspace_, doc.date, doc.title, doc.content);
+  } else {
+    // The live replica would overwrite it with its next save.
+    if (live_docs->is_open(path_doc_)) {
+      response_.result(http::status::conflict);
+      return;
+    }
+    db->update_doc(workspace_, last_segment_, doc.title, doc.content);
+    changed_doc_ = path_doc_;
+  }
+}
+
+void http_connection::edit_doc() {
+  std::int64_t base = 0;
+  std::vector<DocOp> ops;
+  if (!parse_doc_edit(json_value_, base, ops)) {
+    response_.result(http::status::bad_request);
+    return;
+  }
+  if (live_docs->is_open(path_doc_)) { // as in save_doc
+    response_.result(http::status::conflict);
+    return;
+  }
+  std::int64_t revision = 0;
+  switch (db->edit_doc(workspace_, last_segment_, base, ops, revision)) {
+  case DocEdit::applied:
+    changed_doc_ = path_doc_;
+    break;
+  case DocEdit::conflict:
+    // The body still says where the doc is, so the client can fetch it and
+    // redo its edit against that revision.
+    response_.result(http::status::conflict);
+    break;
+  case DocEdit::out_of_range:
+    response_.result(http::status::unprocessable_entity);
+    return;
+  case DocEdit::missing:
+    response_.result(http::status::not_found);
+    return;
+  }
+  response_.set(http::field::content_type, "application/json");
+  JsonWriter json(response_.body());
+  json.begin_object();
+  json.key("revision");
+  json.number(revision);
+  json.end_object();
+}
+
+void http_connection::ping() {
+  presence->ping(workspace_, std::string(body_));
+  response_.body() = "pong";
+}
+
+void http_connection::online_users() {
+  response_.set(http::field::content_type, "application/json");
+  JsonWriter json(response_.body());
+  json.begin_object();
+  json.key("list");
+  json.begin_array();
+  // The caller always counts as online.
+  bool listed = false;
+  presence->for_each_online(workspace_, [&](std::string_view user) {
+    listed = listed || user == body_;
+    json.string(user);
+  });
+  if (!listed)
+    json.string(body_);
+  json.end_array();
+  json.end_object();
+}
+
+void http_connection::get_doc() {
+  response_.set(http::field::content_type, "application/json");
+  if (!etag_.empty())
+    response_.set(http::field::etag, etag_);
+  auto write_doc = [this](std::string_view title, std::string_view content,
+                          std::int64_t revision) {
+    JsonWriter json(response_.body());
+    json.begin_object();
+    json.key("title");
+    json.string(title);
+    json.key("content");
+    json.string(content);
+    // What PATCH /docs/{id} edits are based on.
+    json.key("revision");
+    json.number(revision);
+    json.end_object();
+  };
+  // A missing doc reads as an empty one.
+  if (!db->get_doc_by_id(workspace_, last_segment_, write_doc))
+    write_doc({}, {}, 0);
+}
+
+void http_connection::delete_doc() {
+  db->delete_doc(workspace_, last_segment_);
+  changed_doc_ = path_doc_;
+}
+
+void http_connection::list_revisions() {
+  // Newest first. As with GET /chat, before_id pages back and limit caps the
+  // page size.
+  std::int64_t before_id = std::numeric_limits<std::int64_t>::max();
+  std::int64_t limit = max_revision_page;
+  auto url = boost::urls::parse_origin_form(request_.target());
   try {
-    if (request_.method() == http::verb::post &&
-        request_.target() == "/login") { // Login
-      auto login_request =
-          LoginRequest(boost::json::value_to<LoginRequest>(json_value));
-      auto token = db->login(login_request.id, login_request.password);
-      if (!token.empty()) {
-        response_.set(http::field::content_type, "text/plain");
-        beast::ostream(response_.body()) << token;
-      } else {
-        response_.result(http::status::unauthorized);
-      }
-    } else if (request_.method() == http::verb::get &&
-               request_.target() == "/chat") { // Get chat messages
-      response_.set(http::field::content_type, "application/json");
-      auto chats = db->select_chats_by_workspace(workspace);
-      boost::json::object obj;
-      obj["list"] = boost::json::value_from(chats);
-      boost::json::value response_value = obj;
-      beast::ostream(response_.body()) << response_value;
-    } else if (request_.method() == http::verb::get &&
-               request_.target() == "/docs") { // Get list of docs
-      response_.set(http::field::content_type, "application/json");
-      boost::json::array arr;
-      auto docs = db->select_docs_by_workspace_and_date(
-          Base64::decode(auth_header->value()), body_str);
-      for (auto &doc : docs) {
-        arr.emplace_back(
-            boost::json::value({{"id", doc.first}, {"title", doc.second}}));
-      }
-      boost::json::object obj;
-      obj["list"] = arr;
-      boost::json::value response_value = obj;
-      beast::ostream(response_.body()) << response_value;
-    } else if (request_.method() == http::verb::post &&
-               request_.target() == "/chat") { // Send chat message
-      db->insert_chat(Base64::decode(auth_header->value()), body_str);
-    } else if (request_.method() == http::verb::post &&
-               request_.target().starts_with("/docs")) {
-      Document doc = boost::json::value_to<Document>(json_value);
-      if (last_segment == "" || last_segment == "docs") {
-        db->insert_doc(workspace, doc.date, doc.title, doc.content);
-      } else {
-        db->update_doc(last_segment, doc.title, doc.content);
-      }
-    } else if (request_.method() == http::verb::post &&
-               request_.target() == "/ping") {
-      if (auth_header != request_.end()) {
-        db->upsert_online_users(workspace, body_str);
-        beast::ostream(response_.body()) << "pong";
-      }
-    } else if (request_.method() == http::verb::post &&
-               request_.target() ==
-                   "/online_users") { // Get list of online users
-      response_.set(http::field::content_type, "application/json");
-      auto online_users = db->select_online_users_by_workspace(workspace);
-      if (std::find(online_users.begin(), online_users.end(), body_str) ==
-          online_users.end()) {
-        online_users.push_back(body_str);
-      }
-      boost::json::array online_user_array;
-      for (const auto &user : online_users) {
-        online_user_array.emplace_back(user);
-      }
-      boost::json::object obj;
-      obj["list"] = online_user_array;
-      boost::json::value response_value = obj;
-      beast::ostream(response_.body()) << response_value;
-    } else if (request_.method() == http::verb::get &&
-               request_.target().starts_with("/docs")) { // Get single document
-      response_.set(http::field::content_type, "application/json");
-      auto doc_id = last_segment;
-      auto title_content = db->get_doc_by_id(doc_id);
-      boost::json::object response_body;
-      response_body["title"] = title_content.first;
-      response_body["content"] = title_content.second;
-      auto result = boost::json::serialize(response_body);
-      beast::ostream(response_.body()) << result;
-    } else if (request_.method() == http::verb::delete_ &&
-               request_.target().starts_with(
-                   "/docs")) { // Delete single document
-      auto doc_id = last_segment;
-      db->delete_doc(doc_id);
-    } else { // Invalid request
-      response_.result(http::status::not_found);
-      response_.set(http::field::content_type, "text/plain");
-      beast::ostream(response_.body()) << "Not found\r\n";
+    if (!url)
+      throw std::invalid_argument("malformed target");
+    for (auto param : url->params()) {
+      if (param.key == "before_id")
+        before_id = int_param(param.value);
+      else if (param.key == "limit")
+        limit = std::min(int_param(param.value), max_revision_page);
     }
-  } catch (const std::runtime_error &e) {
-    std::cerr << e.what() << '\n';
-    response_.result(http::status::internal_server_error);
+    if (limit <= 0)
+      throw std::invalid_argument("limit must be positive");
+  } catch (const std::logic_error &) {
+    response_.result(http::status::bad_request);
+    return;
   }
-  write_response();
+
+  response_.set(http::field::content_type, "application/json");
+  JsonWriter json(response_.body());
+  json.begin_object();
+  json.key("list");
+  json.begin_array();
+  std::int64_t written = 0;
+  bool has_more = false;
+  // One extra row tells whether an older page follows.
+  db->select_doc_revisions(
+      workspace_, doc_id_, before_id, limit + 1,
+      [&](std::int64_t revision, std::int64_t time, std::int64_t length) {
+        if (written == limit) {
+          has_more = true;
+          return;
+        }
+        ++written;
+        json.begin_object();
+        json.key("revision");
+        json.number(revision);
+        json.key("time");
+        json.number(time);
+        json.key("length");
+        json.number(length);
+        json.end_object();
+        flush_chunk();
+      });
+  json.end_array();
+  json.key("has_more");
+  json.boolean(has_more);
+  json.end_object();
+}
+
+void http_connection::get_revision() {
+  std::int64_t revision = 0;
+  try {
+    revision = int_param(last_segment_);
+  } catch (const std::logic_error &) {
+    response_.result(http::status::bad_request);
+    return;
+  }
+  std::string content;
+  std::int64_t time = 0;
+  if (!db->get_doc_revision(workspace_, doc_id_, revision, content, time)) {
+    response_.result(http::status::not_found);
+    return;
+  }
+  response_.set(http::field::content_type, "application/json");
+  JsonWriter json(response_.body());
+  json.begin_object();
+  json.key("revision");
+  json.number(revision);
+  json.key("time");
+  json.number(time);
+  json.key("content");
+  json.string(content);
+  json.end_object();
+}
+
+void http_connection::get_metrics() {
+  response_.set(http::field::content_type, "text/plain; version=0.0.4");
+  auto &text = response_.body();
+  metrics::render_prometheus(text);
+  text += "# TYPE collabchat_statement_cache_hits_total counter\n"
+          "collabchat_statement_cache_hits_total ";
+  text += std::to_string(db->statement_cache_hits());
+  text += "\n# TYPE collabchat_statement_cache_misses_total counter\n"
+          "collabchat_statement_cache_misses_total ";
+  text += std::to_string(db->statement_cache_misses());
+  text += "\n# TYPE collabchat_page_cache_hits_total counter\n"
+          "collabchat_page_cache_hits_total ";
+  text += std::to_string(db->page_cache_hits());
+  text += "\n# TYPE collabchat_page_cache_misses_total counter\n"
+          "collabchat_page_cache_misses_total ";
+  text += std::to_string(db->page_cache_misses());
+  text += '\n';
 }
 
 void http_connection::write_response() {
   auto self = shared_from_this();
-  response_.content_length(response_.body().size());
+  // A 304 has no body, and a Content-Length would have to be the full one's.
+  if (response_.result() != http::status::not_modified)
+    response_.content_length(response_.body().size());
+  write_started_ = metrics::clock::now();
   http::async_write(socket_, response_,
                     [self](beast::error_code ec, std::size_t) {
-                      self->socket_.shutdown(tcp::socket::shutdown_send, ec);
-                      self->deadline_.cancel();
+                      self->finish_response(ec, self->response_.need_eof());
                     });
 }
 
+void http_connection::flush_chunk() {
+  // HTTP/1.0 has no chunked encoding; those clients get the whole body.
+  if (response_.body().size() < chunk_size || request_.version() < 11)
+    return;
+  if (!streaming_) {
+    streaming_ = true;
+    chunked_header_.base() = response_.base();
+    chunked_header_.chunked(true);
+    stream_deadline_ = std::chrono::steady_clock::now() + stream_timeout;
+  }
+  if (!chunks_.push(response_.body(), stream_deadline_))
+    throw std::runtime_error("Client stopped reading the response");
+  net::post(socket_.get_executor(),
+            [self = shared_from_this()] { self->write_chunks(); });
+}
+
+void http_connection::write_chunks() {
+  if (chunk_writing_)
+    return; // the running write picks up what is queued
+  if (chunks_.cancelled()) { // the handler failed or the client went away
+    if (socket_.is_open())
+      close();
+    return;
+  }
+  auto self = shared_from_this();
+  auto on_write = [self](beast::error_code ec, std::size_t) {
+    self->chunk_writing_ = false;
+    if (ec) {
+      self->chunks_.cancel();
+      self->finish_response(ec, true);
+      return;
+    }
+    self->chunks_.recycle(std::move(self->chunk_));
+    self->write_chunks();
+  };
+
+  // A slow but steady download is not idle.
+  deadline_.expires_after(idle_timeout);
+  if (!header_serializer_) {
+    write_started_ = metrics::clock::now();
+    header_serializer_.emplace(chunked_header_);
+    chunk_writing_ = true;
+    http::async_write_header(socket_, *header_serializer_, on_write);
+  } else if (chunks_.pop(chunk_)) {
+    chunk_writing_ = true;
+    net::async_write(socket_, http::make_chunk(net::buffer(chunk_)),
+                     on_write);
+  } else if (chunks_.done()) {
+    chunk_writing_ = true;
+    net::async_write(socket_, http::make_chunk_last(),
+                     [self](beast::error_code ec, std::size_t) {
+                       self->chunk_writing_ = false;
+                       self->finish_response(
+                           ec, self->chunked_header_.need_eof());
+                     });
+  }
+}
+
+void http_connection::finish_response(beast::error_code ec, bool need_eof) {
+  auto now = metrics::clock::now();
+  metrics::record(route_id_, metrics::Phase::write, now - write_started_);
+  metrics::record(route_id_, metrics::Phase::total, now - request_started_);
+  if (ec || need_eof) {
+    close();
+    return;
+  }
+  // Keep the connection, buffer_ and both bodies' capacity for the next
+  // request. The parser appends to the body, so it must start out empty.
+  request_.clear();
+  request_.body().clear();
+  response_.clear();
+  response_.body().clear();
+  streaming_ = false;
+  header_serializer_.reset();
+  chunks_.reset();
+  read_request();
+}
+
+void http_connection::close() {
+  // Reached again by the read or write the close aborted.
+  if (!socket_.is_open())
+    return;
+  beast::error_code ec;
+  socket_.shutdown(tcp::socket::shutdown_send, ec);
+  socket_.close(ec);
+  deadline_.cancel();
+  metrics::increment(metrics::Counter::connections_closed);
+}
+
 void http_connection::check_deadline() {
   auto self = shared_from_this();
   deadline_.async_wait([self](beast::error_code ec) {
-    if (!ec) {
-      // Close socket
-      self->socket_.close(ec);
+    if (!self->socket_.is_open())
+      return;
+    if (self->deadline_.expiry() <= net::steady_timer::clock_type::now()) {
+      metrics::increment(metrics::Counter::deadline_expirations);
+      self->close();
+      return;
     }
+    // The timer was re-armed by a new request; keep watching.
+    self->check_deadline();
   });
 }
@@ -1,13 +1,24 @@
 #ifndef HTTP_CONNECTION_HPP
 #define HTTP_CONNECTION_HPP
 
-#include "base64.hpp"
 #include "database.hpp"
+#include "chat_hub.hpp"
+#include "chunk_queue.hpp"
+#include "db_executor.hpp"
+#include "live_docs.hpp"
+#include "metrics.hpp"
+#include "password_hasher.hpp"
+#include "presence.hpp"
+#include "server_context.hpp"
+#include "sessions.hpp"
+#include "versions.hpp"
+#include "write_batcher.hpp"
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/json.hpp>
 #include <boost/shared_ptr.hpp>
+#include <optional>
 
 namespace net = boost::asio;
 namespace beast = boost::beast;
@@ -16,7 +27,7 @@ using tcp = net::ip::tcp;
 
 class http_connection : public std::enable_shared_from_this<http_connection> {
 public:
-  explicit http_connection(tcp::socket socket, Database *db);
+  explicit http_connection(tcp::socket socket, const ServerContext &context);
 
   // Initiate the asynchronous operations associated with the connection.
   void start();
@@ -25,34 +36,184 @@ private:
   // Database
   Database *db;
 
+  // Pool the route handlers run on, off the connection's strand.
+  DbExecutor *db_executor;
+
+  // Group commit for the handlers that write.
+  WriteBatcher *write_batcher;
+
+  // WebSocket subscribers that new chat messages are pushed to.
+  ChatHub *chat_hub;
+
+  // Who is online, kept in memory instead of the online_users table.
+  PresenceTracker *presence;
+
+  // Login sessions that requests authenticate against.
+  SessionStore *sessions;
+
+  // Pool that login runs on, since it hashes passwords.
+  PasswordHasher *password_hasher;
+
+  // Docs open for live editing over WebSocket.
+  LiveDocs *live_docs;
+
+  // What the ETags of GET /docs/{id} and GET /chat are made from.
+  ContentVersions *versions;
+
   // The socket for the currently connected client.
   tcp::socket socket_;
 
   // The buffer for performing reads.
   beast::flat_buffer buffer_{16384};
 
-  // The request message.
-  http::request<http::dynamic_body> request_;
-
-  // The response message.
-  http::response<http::dynamic_body> response_;
-
-  // The timer for putting a deadline on connection processing.
-  net::steady_timer deadline_{socket_.get_executor(), std::chrono::seconds(60)};
+  // The request message. Its body is one contiguous string that handlers
+  // read in place; its capacity is kept for the next request.
+  http::request<http::string_body> request_;
+
+  // The response message, likewise reused across requests.
+  http::response<http::string_body> response_;
+
+  // Chunked responses. A handler that streams rows calls flush_chunk(), which
+  // hands response_.body() over to chunks_ whenever chunk_size bytes have
+  // built up. The strand then writes chunked_header_ followed by each chunk,
+  // so the first bytes go out before the query has finished. The handler
+  // holds its DB connection meanwhile, so a client too slow to have taken
+  // all but the last few chunks within stream_timeout has the response cut
+  // off rather than keep the connection.
+  static constexpr std::size_t chunk_size = 16384;
+  static constexpr std::chrono::seconds stream_timeout{10};
+  bool streaming_ = false;
+  std::chrono::steady_clock::time_point stream_deadline_;
+  ChunkQueue chunks_;
+  http::response<http::empty_body> chunked_header_;
+  std::optional<http::response_serializer<http::empty_body>>
+      header_serializer_;
+  std::string chunk_; // being written
+  bool chunk_writing_ = false;
+
+  // Metrics bookkeeping for the current request.
+  metrics::Route route_id_ = metrics::Route::not_found;
+  metrics::clock::time_point request_started_;
+  metrics::clock::time_point write_started_;
+
+  // Arena for the parsed JSON body. Everything json_value_ holds is
+  // allocated from it and dropped in one go before the next request is
+  // parsed; bodies that fit in json_buffer_ never touch the heap.
+  static constexpr std::size_t json_arena_size = 8192;
+  alignas(std::max_align_t) unsigned char json_buffer_[json_arena_size];
+  boost::json::monotonic_resource json_arena_{json_buffer_, json_arena_size};
+
+  // Kept across requests so its internal stack is only allocated once.
+  boost::json::parser json_parser_;
+
+  // Values parsed from the current request for the route handlers. The
+  // strings are assigned in place to reuse their capacity.
+  std::string workspace_;
+  bool has_workspace_ = false;
+  std::string last_segment_;
+  std::string doc_id_; // of /docs/{id}/revisions routes
+  std::int64_t path_doc_ = 0; // the id of any /docs/{id} route
+  std::string_view body_; // request_.body()
+  boost::json::value json_value_{boost::json::storage_ptr(&json_arena_)};
+
+  // Chat message post_chat inserted, pushed to subscribers once it has been
+  // committed.
+  std::string pending_broadcast_;
+
+  // Doc a handler changed, whose version is bumped once it has committed.
+  std::optional<std::int64_t> changed_doc_;
+
+  // ETag of what the current GET returns, taken before it is read.
+  std::string etag_;
+
+  // Largest page GET /chat returns when the client passes a limit.
+  static constexpr std::int64_t max_chat_page = 1000;
+
+  // Largest page of GET /docs/{id}/revisions, and what it returns without a
+  // limit.
+  static constexpr std::int64_t max_revision_page = 1000;
+
+  // How long a connection may sit idle waiting for the next request.
+  static constexpr std::chrono::seconds idle_timeout{60};
+
+  // The timer for closing connections that stay idle too long. It is re-armed
+  // whenever a new request starts being read.
+  net::steady_timer deadline_{socket_.get_executor()};
 
   // Asynchronously receive a complete request message.
   void read_request();
 
+  using route_handler = void (http_connection::*)();
+
+  // Where a route handler runs.
+  enum class Dispatch {
+    strand,     // in memory, answered straight away
+    db_pool,     // reads, on a DbExecutor worker
+    write_batch, // writes, inside a WriteBatcher transaction
+    hash_pool    // password hashing, on a PasswordHasher thread
+  };
+
+  // Parse the request and dispatch it to its route handler.
   void router();
 
+  // Call route, recording its db and serialize phases.
+  void run_handler(route_handler route);
+
+  // Back on the strand after a DB handler: report its error, if any, publish
+  // what it committed and send the response.
+  void finish_handler(std::exception_ptr error);
+
+  // Look up the session token in credentials ("Bearer <token>" or the bare
+  // token) and set workspace_ to its workspace; false if there is none.
+  bool authenticate(std::string_view credentials);
+
+  // For GET /docs/{id} and GET /chat: set etag_, and answer 304 if the
+  // client's copy has it. Returns whether it did.
+  bool not_modified();
+
+  // Hand the socket over to a websocket_session subscribed to workspace_,
+  // or with a doc_id to a doc_session editing that doc.
+  void upgrade_to_websocket(std::optional<std::int64_t> doc_id = {});
+
+  // Route handlers. They only fill in response_ and run where router()
+  // dispatches them; see Dispatch.
+  void login();
+  void logout();
+  void get_chat();
+  void post_chat();
+  void list_docs();
+  void get_doc();
+  void save_doc();
+  void edit_doc();
+  void delete_doc();
+  void list_revisions();
+  void get_revision();
+  void ping();
+  void online_users();
+  void get_metrics();
+
   // Asynchronously transmit the response message.
   void write_response();
 
+  // From a streaming handler on the DB worker: send what response_.body()
+  // holds so far as a chunk once it is big enough. Waits while the client
+  // is behind and throws if it has gone away or stream_timeout runs out.
+  void flush_chunk();
+
+  // On the strand: write whatever chunks are queued, then the last chunk.
+  void write_chunks();
+
+  // Once the response is out: record it and read the next request, or close.
+  void finish_response(beast::error_code ec, bool need_eof);
+
+  // Send FIN and stop the idle timer once the conversation is over.
+  void close();
+
   // Check whether we have spent enough time on this connection.
   void check_deadline();
 };
 
 // "Loop" forever accepting new connections.
-void http_server(tcp::acceptor &acceptor, tcp::socket &socket);
+void http_server(tcp::acceptor &acceptor, const ServerContext &context);
 
 #endif // HTTP_CONNECTION_HPP
@@ -0,0 +1,98 @@
+#include "json_writer.hpp"
+#include <charconv>
+
+void JsonWriter::separate() {
+  if (after_key) {
+    after_key = false;
+    return;
+  }
+  std::uint64_t bit = std::uint64_t{1} << depth;
+  if (has_element & bit)
+    out += ',';
+  has_element |= bit;
+}
+
+void JsonWriter::open(char bracket) {
+  separate();
+  out += bracket;
+  ++depth;
+  has_element &= ~(std::uint64_t{1} << depth);
+}
+
+void JsonWriter::close(char bracket) {
+  --depth;
+  out += bracket;
+}
+
+void JsonWriter::begin_object() { open('{'); }
+void JsonWriter::end_object() { close('}'); }
+void JsonWriter::begin_array() { open('['); }
+void JsonWriter::end_array() { close(']'); }
+
+void JsonWriter::key(std::string_view name) {
+  separate();
+  append_json_string(out, name);
+  out += ':';
+  after_key = true;
+}
+
+void JsonWriter::string(std::string_view text) {
+  separate();
+  append_json_string(out, text);
+}
+
+void JsonWriter::number(std::int64_t value) {
+  separate();
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+  out.append(buffer, result.ptr - buffer);
+}
+
+void JsonWriter::boolean(bool value) {
+  separate();
+  out += value ? "true" : "false";
+}
+
+void append_json_string(std::string &out, std::string_view text) {
+  static const char hex[] = "0123456789abcdef";
+  out += '"';
+  // Copy runs of plain characters in one go; only quotes, backslashes and
+  // control characters need escaping.
+  std::size_t run = 0;
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    auto c = static_cast<unsigned char>(text[i]);
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(text.data() + run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    default:
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+    }
+  }
+  out.append(text.data() + run, text.size() - run);
+  out += '"';
+}
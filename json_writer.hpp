@@ -0,0 +1,44 @@
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Appends JSON to a string as it is produced, so handlers can write rows
+// straight from SQLite into the response body without building a
+// boost::json::value first. Commas and colons are inserted automatically;
+// the caller is responsible for balancing begin/end calls.
+class JsonWriter {
+public:
+  explicit JsonWriter(std::string &out) : out(out) {}
+
+  void begin_object();
+  void end_object();
+  void begin_array();
+  void end_array();
+
+  // Member name; the next call writes its value.
+  void key(std::string_view name);
+
+  void string(std::string_view text);
+  void number(std::int64_t value);
+  void boolean(bool value);
+
+private:
+  // Write the separator that goes before a new element.
+  void separate();
+  void open(char bracket);
+  void close(char bracket);
+
+  std::string &out;
+  // Bit n is set once the container at depth n has an element.
+  std::uint64_t has_element = 0;
+  unsigned int depth = 0;
+  bool after_key = false;
+};
+
+// Append text as a quoted JSON string.
+void append_json_string(std::string &out, std::string_view text);
+
+#endif // JSON_WRITER_HPP
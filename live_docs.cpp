@@ -0,0 +1,391 @@
+#include "live_docs.hpp"
+#include "database.hpp"
+#include "doc_session.hpp"
+#include "json_writer.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "versions.hpp"
+#include "write_batcher.hpp"
+#include <algorithm>
+#include <boost/json.hpp>
+#include <stdexcept>
+
+namespace {
+
+void log_failure(const char *what, std::exception_ptr error) {
+  if (!error)
+    return;
+  try {
+    std::rethrow_exception(error);
+  } catch (const std::exception &e) {
+    logging::error(what, e.what());
+  }
+}
+
+bool get_id(const boost::json::value &client, const boost::json::value &clock,
+            CrdtId &id) {
+  if (!client.is_int64() || !clock.is_int64() || client.as_int64() < 0 ||
+      client.as_int64() > UINT32_MAX || clock.as_int64() < 0)
+    return false;
+  id = {static_cast<std::uint32_t>(client.as_int64()),
+        static_cast<std::uint64_t>(clock.as_int64())};
+  return true;
+}
+
+// An id written as [client, clock].
+bool get_id(const boost::json::value *field, CrdtId &id) {
+  auto array = field ? field->if_array() : nullptr;
+  return array && array->size() == 2 && get_id((*array)[0], (*array)[1], id);
+}
+
+bool parse_op(std::string_view message, CrdtOp &op) {
+  boost::system::error_code ec;
+  auto jv = boost::json::parse(message, ec);
+  auto obj = ec ? nullptr : jv.if_object();
+  if (!obj)
+    return false;
+  auto type = obj->if_contains("type");
+  if (!type || !type->is_string())
+    return false;
+
+  if (type->as_string() == "insert") {
+    auto text = obj->if_contains("text");
+    auto origin = obj->if_contains("origin");
+    if (!get_id(obj->if_contains("id"), op.id) || !text ||
+        !text->is_string())
+      return false;
+    if (origin && !origin->is_null() && !get_id(origin, op.origin))
+      return false;
+    op.text = text->as_string();
+    return true;
+  }
+
+  auto spans = obj->if_contains("spans");
+  if (type->as_string() != "delete" || !spans || !spans->is_array())
+    return false;
+  op.kind = CrdtOp::Kind::erase;
+  for (const auto &item : spans->as_array()) {
+    auto span = item.if_array();
+    CrdtSpan parsed;
+    if (!span || span->size() != 3 ||
+        !get_id((*span)[0], (*span)[1], parsed.start) ||
+        !(*span)[2].is_int64() || (*span)[2].as_int64() < 0)
+      return false;
+    parsed.length = static_cast<std::uint64_t>((*span)[2].as_int64());
+    op.spans.push_back(parsed);
+  }
+  return true;
+}
+
+void write_id(JsonWriter &writer, const CrdtId &id) {
+  writer.begin_array();
+  writer.number(id.client);
+  writer.number(static_cast<std::int64_t>(id.clock));
+  writer.end_array();
+}
+
+std::string op_message(const CrdtOp &op) {
+  std::string out;
+  JsonWriter writer(out);
+  writer.begin_object();
+  writer.key("type");
+  if (op.kind == CrdtOp::Kind::insert) {
+    writer.string("insert");
+    writer.key("id");
+    write_id(writer, op.id);
+    if (op.origin.clock) {
+      writer.key("origin");
+      write_id(writer, op.origin);
+    }
+    writer.key("text");
+    writer.string(op.text);
+  } else {
+    writer.string("delete");
+    writer.key("spans");
+    writer.begin_array();
+    for (const auto &span : op.spans) {
+      writer.begin_array();
+      writer.number(span.start.client);
+      writer.number(static_cast<std::int64_t>(span.start.clock));
+      writer.number(static_cast<std::int64_t>(span.length));
+      writer.end_array();
+    }
+    writer.end_array();
+  }
+  writer.end_object();
+  return out;
+}
+
+std::string hello_message(std::uint32_t client, const TextCrdt &crdt) {
+  std::string out;
+  JsonWriter writer(out);
+  writer.begin_object();
+  writer.key("type");
+  writer.string("hello");
+  writer.key("client");
+  writer.number(client);
+  writer.key("runs");
+  writer.begin_array();
+  crdt.for_each_run([&](const TextCrdt::Run &run) {
+    writer.begin_array();
+    writer.number(run.id.client);
+    writer.number(static_cast<std::int64_t>(run.id.clock));
+    writer.number(run.origin.client);
+    writer.number(static_cast<std::int64_t>(run.origin.clock));
+    if (run.deleted)
+      writer.number(static_cast<std::int64_t>(run.length));
+    else
+      writer.string(run.text);
+    writer.end_array();
+  });
+  writer.end_array();
+  writer.end_object();
+  return out;
+}
+
+} // namespace
+
+LiveDocs::LiveDocs(Database &db, WriteBatcher &write_batcher,
+                   ContentVersions &versions)
+    : db(db), write_batcher(write_batcher), versions(versions) {}
+
+void LiveDocs::join(std::int64_t id, const std::string &workspace,
+                    const std::shared_ptr<doc_session> &session) {
+  std::shared_ptr<Doc> doc;
+  bool opened = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &slot = docs[id];
+    if (!slot) {
+      slot = std::make_shared<Doc>();
+      slot->workspace = workspace;
+      opened = true;
+      metrics::add(metrics::Gauge::live_docs, 1);
+    }
+    doc = slot;
+    // Taken before letting go of docs, so that settle cannot close the doc
+    // between looking it up and joining it.
+    std::lock_guard<std::mutex> doc_lock(doc->mutex);
+    if (doc->failed || doc->workspace != workspace)
+      session->close();
+    else if (!doc->loaded)
+      doc->waiting.push_back(session);
+    else
+      add_editor(*doc, session);
+  }
+  if (opened)
+    load(id, doc);
+}
+
+bool LiveDocs::is_open(std::int64_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return docs.count(id) != 0;
+}
+
+void LiveDocs::leave(std::int64_t id, const doc_session *session) {
+  std::shared_ptr<Doc> doc;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = docs.find(id);
+    if (found == docs.end())
+      return;
+    doc = found->second;
+  }
+  {
+    std::lock_guard<std::mutex> lock(doc->mutex);
+    auto &editors = doc->editors;
+    editors.erase(std::remove_if(editors.begin(), editors.end(),
+                                 [session](const Editor &editor) {
+                                   return editor.session == session;
+                                 }),
+                  editors.end());
+    // Failures while it had editors do not count against the closing save.
+    if (editors.empty())
+      doc->failed_saves = 0;
+  }
+  settle(id, doc);
+}
+
+bool LiveDocs::apply(std::int64_t id, const doc_session *session,
+                     std::string_view message) {
+  CrdtOp op;
+  if (!parse_op(message, op))
+    return false;
+  std::shared_ptr<Doc> doc;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = docs.find(id);
+    if (found == docs.end())
+      return false;
+    doc = found->second;
+  }
+
+  // Released after the lock, in case one of them is the last reference.
+  std::vector<std::shared_ptr<doc_session>> recipients;
+  std::lock_guard<std::mutex> lock(doc->mutex);
+  auto editor = std::find_if(
+      doc->editors.begin(), doc->editors.end(),
+      [session](const Editor &editor) { return editor.session == session; });
+  if (editor == doc->editors.end())
+    return false;
+  if (op.kind == CrdtOp::Kind::insert && op.id.client != editor->client)
+    return false;
+  if (!doc->crdt.apply(op))
+    return false;
+  metrics::increment(metrics::Counter::crdt_ops);
+
+  // Logged and relayed under the lock, so that the log and every editor get
+  // the ops in the order they were merged.
+  auto seq = ++doc->seq;
+  std::string encoded;
+  encode_crdt_op(op, encoded);
+  write_batcher.async_run(
+      [this, id, seq, encoded = std::move(encoded)] {
+        db.insert_crdt_op(id, seq, encoded);
+      },
+      [](std::exception_ptr error) {
+        log_failure("Logging a live doc op failed: ", error);
+      });
+  auto payload = std::make_shared<const std::string>(op_message(op));
+  for (const auto &other : doc->editors) {
+    if (other.session == session)
+      continue;
+    if (auto recipient = other.ref.lock()) {
+      recipient->send(payload);
+      recipients.push_back(std::move(recipient));
+    }
+  }
+
+  if (seq - doc->saved_seq >= snapshot_every && !doc->saving)
+    save(id, doc);
+  return true;
+}
+
+void LiveDocs::add_editor(Doc &doc,
+                          const std::shared_ptr<doc_session> &session) {
+  auto client = doc.next_client++;
+  doc.editors.push_back({session.get(), session, client});
+  session->send(
+      std::make_shared<const std::string>(hello_message(client, doc.crdt)));
+}
+
+void LiveDocs::save(std::int64_t id, const std::shared_ptr<Doc> &doc) {
+  doc->saving = true;
+  auto seq = doc->seq;
+  std::string state;
+  doc->crdt.encode(state);
+  write_batcher.async_run(
+      [this, id, seq, state = std::move(state), text = doc->crdt.text()] {
+        db.save_crdt(id, seq, state, text);
+      },
+      [this, id, doc, seq](std::exception_ptr error) {
+        // After a failure the ops stay unsaved, for settle or the next op
+        // to save again.
+        log_failure("Saving a live doc failed: ", error);
+        if (!error)
+          versions.bump_doc(id);
+        {
+          std::lock_guard<std::mutex> lock(doc->mutex);
+          doc->saving = false;
+          if (error) {
+            ++doc->failed_saves;
+          } else {
+            doc->failed_saves = 0;
+            doc->saved_seq = seq;
+          }
+        }
+        settle(id, doc);
+      });
+}
+
+void LiveDocs::load(std::int64_t id, const std::shared_ptr<Doc> &doc) {
+  struct Loaded {
+    TextCrdt crdt;
+    std::int64_t seq = 0;
+    std::int64_t saved_seq = 0;
+    bool stale = false; // the text was changed outside; no usable snapshot
+  };
+  auto result = std::make_shared<Loaded>();
+  // In a write batch, behind any HTTP write that found the doc closed.
+  write_batcher.async_run(
+      [this, id, workspace = doc->workspace, result] {
+        std::string content;
+        std::int64_t revision = 0;
+        StoredCrdt stored;
+        bool found = db.load_crdt(
+            workspace, id,
+            [&](std::string_view, std::string_view text, std::int64_t rev) {
+              content.assign(text);
+              revision = rev;
+            },
+            stored);
+        if (!found)
+          throw std::runtime_error("No doc " + std::to_string(id));
+        result->saved_seq = stored.seq;
+        result->seq = stored.seq + static_cast<std::int64_t>(stored.ops.size());
+        if (stored.revision != revision) {
+          // Start over from the saved text; the snapshot taken right away
+          // drops the old log.
+          result->crdt.insert(0, 0, std::move(content));
+          result->stale = true;
+          return;
+        }
+        result->crdt = TextCrdt::decode(stored.state);
+        for (const auto &op : stored.ops) {
+          if (!result->crdt.apply(decode_crdt_op(op)))
+            throw std::runtime_error("Logged op of doc " + std::to_string(id) +
+                                     " does not apply");
+        }
+      },
+      [this, id, doc, result](std::exception_ptr error) {
+        std::vector<std::shared_ptr<doc_session>> waiting;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          std::lock_guard<std::mutex> doc_lock(doc->mutex);
+          for (const auto &ref : doc->waiting) {
+            if (auto session = ref.lock())
+              waiting.push_back(std::move(session));
+          }
+          doc->waiting.clear();
+          if (error) {
+            log_failure("Opening a live doc failed: ", error);
+            doc->failed = true;
+            for (const auto &session : waiting)
+              session->close();
+            auto found = docs.find(id);
+            if (found != docs.end() && found->second == doc) {
+              docs.erase(found);
+              metrics::add(metrics::Gauge::live_docs, -1);
+            }
+            return;
+          }
+          doc->crdt = std::move(result->crdt);
+          doc->seq = result->seq;
+          doc->saved_seq = result->saved_seq;
+          doc->next_client = doc->crdt.max_client() + 1;
+          doc->loaded = true;
+          if (result->stale)
+            save(id, doc);
+          for (const auto &session : waiting)
+            add_editor(*doc, session);
+        }
+        // Everyone may have left while it loaded.
+        settle(id, doc);
+      });
+}
+
+void LiveDocs::settle(std::int64_t id, const std::shared_ptr<Doc> &doc) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::lock_guard<std::mutex> doc_lock(doc->mutex);
+  if (!doc->loaded || doc->saving || !doc->editors.empty())
+    return;
+  if (doc->seq != doc->saved_seq && doc->failed_saves < save_attempts) {
+    save(id, doc);
+    return;
+  }
+  auto found = docs.find(id);
+  if (found != docs.end() && found->second == doc) {
+    docs.erase(found);
+    metrics::add(metrics::Gauge::live_docs, -1);
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef LIVE_DOCS_HPP
+#define LIVE_DOCS_HPP
+
+#include "crdt.hpp"
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class ContentVersions;
+class Database;
+class WriteBatcher;
+class doc_session;
+
+// Docs being edited live over WebSocket. Each open doc keeps a TextCrdt
+// replica in memory; every editor's op is merged into it and relayed to the
+// doc's other editors, so their replicas converge without locking anyone
+// out. Ops are logged to crdt_ops as they arrive, and every snapshot_every
+// ops, or when the last editor leaves, the replica is snapshotted and its
+// text saved as the doc's content. While a doc is open, HTTP writes to it are
+// refused (see is_open), as the next save would overwrite them.
+//
+// The protocol, one JSON text frame per message:
+//   server -> editor  {"type":"hello","client":3,"runs":[run, ...]} once,
+//                     where run is [client, clock, origin client, origin
+//                     clock, "text"], or the length instead of the text for
+//                     deleted runs; then every other editor's ops.
+//   editor -> server  {"type":"insert","id":[3,41],"origin":[1,7],
+//                     "text":"abc"}, "origin" left out at the start, and
+//                     {"type":"delete","spans":[[1,7,2], ...]}.
+// An editor inserts with its own client id and a clock above any it has
+// seen, as TextCrdt::insert does.
+class LiveDocs {
+public:
+  LiveDocs(Database &db, WriteBatcher &write_batcher,
+           ContentVersions &versions);
+
+  LiveDocs(const LiveDocs &) = delete;
+  LiveDocs &operator=(const LiveDocs &) = delete;
+
+  // Make session an editor of doc id, loading the doc if nobody has it open.
+  // The session is sent its hello, or closed if there is no such doc in
+  // workspace.
+  void join(std::int64_t id, const std::string &workspace,
+            const std::shared_ptr<doc_session> &session);
+  void leave(std::int64_t id, const doc_session *session);
+
+  // Merge an op message from session and relay it; false if it is malformed
+  // or not the session's to make.
+  bool apply(std::int64_t id, const doc_session *session,
+             std::string_view message);
+
+  // Whether doc id is open for live editing. Docs are loaded and saved
+  // inside write batches, so a write job that finds the doc closed commits
+  // before any replica of it is read, and one that finds it open must not
+  // write to it.
+  bool is_open(std::int64_t id);
+
+  static constexpr std::int64_t snapshot_every = 256;
+
+private:
+  struct Editor {
+    const doc_session *session;
+    std::weak_ptr<doc_session> ref;
+    std::uint32_t client;
+  };
+
+  struct Doc {
+    std::mutex mutex;
+    std::string workspace; // of whoever opened it; load checks it is the doc's
+    bool loaded = false;
+    bool failed = false; // no such doc; joiners are turned away
+    TextCrdt crdt;
+    std::int64_t seq = 0;       // of the last op merged
+    std::int64_t saved_seq = 0; // of the last op in the stored snapshot
+    bool saving = false;
+    int failed_saves = 0; // in a row
+    std::uint32_t next_client = 1;
+    std::vector<Editor> editors;
+    std::vector<std::weak_ptr<doc_session>> waiting; // for the load
+  };
+
+  // With doc locked.
+  void add_editor(Doc &doc, const std::shared_ptr<doc_session> &session);
+  void save(std::int64_t id, const std::shared_ptr<Doc> &doc);
+
+  void load(std::int64_t id, const std::shared_ptr<Doc> &doc);
+  // Once a doc has no editors: save what is unsaved, then close it. A save
+  // that fails is retried, up to save_attempts times in a row; after that
+  // the doc is closed anyway, and its ops are replayed from the log when it
+  // is next opened.
+  void settle(std::int64_t id, const std::shared_ptr<Doc> &doc);
+  static constexpr int save_attempts = 3;
+
+  Database &db;
+  WriteBatcher &write_batcher;
+  ContentVersions &versions; // bumped by each save
+
+  std::mutex mutex; // taken before any Doc's
+  std::unordered_map<std::int64_t, std::shared_ptr<Doc>> docs;
+};
+
+#endif // LIVE_DOCS_HPP
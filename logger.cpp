@@ -0,0 +1,173 @@
+#include "logger.hpp"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+namespace logging {
+
+namespace {
+
+const char *severity_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// "2024-01-02T03:04:05.678Z"
+void append_timestamp(std::string &out, std::int64_t ns) {
+  std::time_t seconds = static_cast<std::time_t>(ns / 1000000000);
+  std::tm utc;
+  gmtime_r(&seconds, &utc);
+  char buffer[32];
+  std::size_t n = std::strftime(buffer, sizeof buffer, "%Y-%m-%dT%H:%M:%S", &utc);
+  n += std::snprintf(buffer + n, sizeof buffer - n, ".%03dZ",
+                     static_cast<int>(ns / 1000000 % 1000));
+  out.append(buffer, n);
+}
+
+void write_all(const std::string &batch) {
+  const char *data = batch.data();
+  std::size_t left = batch.size();
+  while (left) {
+    ssize_t n = ::write(STDERR_FILENO, data, left);
+    if (n <= 0)
+      return; // nowhere to report it
+    data += n;
+    left -= static_cast<std::size_t>(n);
+  }
+}
+
+} // namespace
+
+Severity parse_severity(std::string_view name) {
+  if (name == "debug")
+    return Severity::debug;
+  if (name == "info")
+    return Severity::info;
+  if (name == "warning")
+    return Severity::warning;
+  if (name == "error")
+    return Severity::error;
+  throw std::invalid_argument("Unknown log level: " + std::string(name));
+}
+
+std::string escape(std::string_view text) {
+  std::string out;
+  for (unsigned char c : text) {
+    if (c == '\\') {
+      out += "\\\\";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\r') {
+      out += "\\r";
+    } else if (c < 0x20 || c == 0x7f) {
+      char buffer[5];
+      std::snprintf(buffer, sizeof buffer, "\\x%02x", c);
+      out += buffer;
+    } else {
+      out += static_cast<char>(c);
+    }
+  }
+  return out;
+}
+
+std::string excerpt(std::string_view body, std::size_t max) {
+  return escape(body.substr(0, max));
+}
+
+Logger &Logger::instance() {
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger() {
+  for (std::size_t i = 0; i < capacity; ++i)
+    ring[i].sequence.store(i, std::memory_order_relaxed);
+  flusher = std::thread([this] { run(); });
+}
+
+Logger::~Logger() {
+  stopping.store(true, std::memory_order_release);
+  flusher.join();
+}
+
+// Bounded MPSC ring after Dmitry Vyukov's queue: a slot is free for position
+// pos when its sequence equals pos and readable when it equals pos + 1.
+Logger::Record *Logger::claim(Severity severity) {
+  std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    Record &record = ring[pos & (capacity - 1)];
+    std::size_t sequence = record.sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                static_cast<std::ptrdiff_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+        record.timestamp = now_ns();
+        record.severity = severity;
+        record.length = 0;
+        return &record;
+      }
+    } else if (diff < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    } else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void Logger::publish(Record *record) {
+  // The slot at index i was claimed for a position congruent to i; the
+  // sequence it was claimed at is what it holds now.
+  std::size_t pos = record->sequence.load(std::memory_order_relaxed);
+  record->sequence.store(pos + 1, std::memory_order_release);
+}
+
+std::size_t Logger::drain(std::string &batch) {
+  std::size_t lines = 0;
+  for (;;) {
+    Record &record = ring[dequeue_pos & (capacity - 1)];
+    if (record.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+      break;
+    append_timestamp(batch, record.timestamp);
+    batch += ' ';
+    batch += severity_names[static_cast<int>(record.severity)];
+    batch += ' ';
+    batch.append(record.text, record.length);
+    batch += '\n';
+    record.sequence.store(dequeue_pos + capacity, std::memory_order_release);
+    ++dequeue_pos;
+    ++lines;
+  }
+  return lines;
+}
+
+void Logger::run() {
+  std::string batch;
+  batch.reserve(64 * 1024);
+  for (;;) {
+    bool stop = stopping.load(std::memory_order_acquire);
+    batch.clear();
+    std::size_t lines = drain(batch);
+    if (auto lost = dropped.exchange(0, std::memory_order_relaxed)) {
+      append_timestamp(batch, now_ns());
+      batch += " WARN logger dropped " + std::to_string(lost) + " lines\n";
+    }
+    if (!batch.empty())
+      write_all(batch);
+    if (stop)
+      return;
+    // Poll rather than have producers signal: logging stays free of syscalls
+    // and a line reaches stderr within a few milliseconds.
+    if (!lines)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+}
+
+} // namespace logging
@@ -0,0 +1,129 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// Asynchronous logging. Callers format straight into a slot of a bounded
+// lock-free ring and return; a background thread drains the ring and writes
+// whole batches to stderr. When the ring is full, lines are dropped and
+// counted rather than blocking the caller.
+namespace logging {
+
+enum class Severity : std::uint8_t { debug, info, warning, error };
+
+// Parse "debug", "info", "warning" or "error"; throws std::invalid_argument.
+Severity parse_severity(std::string_view name);
+
+// text with backslashes and control characters escaped, for logging what a
+// client sent without letting it forge log lines.
+std::string escape(std::string_view text);
+
+// The first max bytes of body, escaped, for logging request payloads.
+std::string excerpt(std::string_view body, std::size_t max = 64);
+
+class Logger {
+public:
+  // Longer lines are cut off.
+  static constexpr std::size_t max_line = 240;
+
+  struct Record {
+    std::atomic<std::size_t> sequence;
+    std::int64_t timestamp; // nanoseconds since the epoch
+    Severity severity;
+    std::uint16_t length;
+    char text[max_line];
+  };
+
+  static Logger &instance();
+
+  void set_level(Severity level) {
+    min_level.store(level, std::memory_order_relaxed);
+  }
+  bool enabled(Severity severity) const {
+    return severity >= min_level.load(std::memory_order_relaxed);
+  }
+
+  // Reserve a slot for one line, or nullptr if the ring is full.
+  Record *claim(Severity severity);
+  // Hand a filled slot to the flusher.
+  void publish(Record *record);
+
+  ~Logger();
+
+private:
+  Logger();
+
+  static constexpr std::size_t capacity = 8192; // power of two
+
+  void run();
+  std::size_t drain(std::string &batch);
+
+  std::array<Record, capacity> ring;
+  alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+  alignas(64) std::size_t dequeue_pos = 0;
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<Severity> min_level{Severity::info};
+  std::atomic<bool> stopping{false};
+  std::thread flusher;
+};
+
+inline void append(Logger::Record &record, std::string_view text) {
+  std::size_t room = Logger::max_line - record.length;
+  std::size_t n = text.size() < room ? text.size() : room;
+  std::memcpy(record.text + record.length, text.data(), n);
+  record.length += static_cast<std::uint16_t>(n);
+}
+
+inline void append(Logger::Record &record, const char *text) {
+  append(record, std::string_view(text));
+}
+
+inline void append(Logger::Record &record, char c) {
+  if (record.length < Logger::max_line)
+    record.text[record.length++] = c;
+}
+
+template <class Integer,
+          class = std::enable_if_t<std::is_integral<Integer>::value>>
+void append(Logger::Record &record, Integer value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+  append(record, std::string_view(buffer, result.ptr - buffer));
+}
+
+// Log the concatenation of parts (strings, characters and integers).
+template <class... Parts> void log(Severity severity, const Parts &...parts) {
+  Logger &logger = Logger::instance();
+  if (!logger.enabled(severity))
+    return;
+  Logger::Record *record = logger.claim(severity);
+  if (!record)
+    return;
+  (append(*record, parts), ...);
+  logger.publish(record);
+}
+
+template <class... Parts> void debug(const Parts &...parts) {
+  log(Severity::debug, parts...);
+}
+template <class... Parts> void info(const Parts &...parts) {
+  log(Severity::info, parts...);
+}
+template <class... Parts> void warning(const Parts &...parts) {
+  log(Severity::warning, parts...);
+}
+template <class... Parts> void error(const Parts &...parts) {
+  log(Severity::error, parts...);
+}
+
+} // namespace logging
+
+#endif // LOGGER_HPP
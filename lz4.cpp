@@ -0,0 +1,159 @@
+#include "lz4.hpp"
+#include "byte_io.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+// A block is a list of sequences. Each starts with a token byte: its high
+// nibble is the number of literals that follow, its low nibble the match
+// length minus 4; a nibble of 15 continues in further bytes that are added
+// on, 255 meaning "more follows". After the literals come a 2-byte little
+// endian offset back into the output and the match's extra length bytes.
+// The last sequence is literals only. As the format requires, the last 5
+// bytes are always literals and no match starts in the last 12.
+
+namespace {
+
+constexpr std::size_t min_match = 4;
+constexpr std::size_t last_literals = 5;
+constexpr std::size_t match_margin = 12;
+constexpr std::size_t max_offset = 65535;
+constexpr unsigned hash_bits = 12;
+
+std::uint32_t hash(std::uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+void put_length(std::string &out, std::size_t length) {
+  while (length >= 255) {
+    out += static_cast<char>(255);
+    length -= 255;
+  }
+  out += static_cast<char>(length);
+}
+
+void put_sequence(std::string &out, const char *literals, std::size_t count,
+                  std::size_t offset, std::size_t match) {
+  auto extra = match - min_match;
+  out += static_cast<char>((std::min<std::size_t>(count, 15) << 4) |
+                           std::min<std::size_t>(extra, 15));
+  if (count >= 15)
+    put_length(out, count - 15);
+  out.append(literals, count);
+  out += static_cast<char>(offset & 0xff);
+  out += static_cast<char>(offset >> 8);
+  if (extra >= 15)
+    put_length(out, extra - 15);
+}
+
+std::size_t get_length(std::string_view in, std::size_t &pos) {
+  std::size_t length = 0;
+  unsigned char byte;
+  do {
+    if (pos >= in.size())
+      throw std::runtime_error("Truncated LZ4 block");
+    byte = static_cast<unsigned char>(in[pos++]);
+    length += byte;
+  } while (byte == 255);
+  return length;
+}
+
+} // namespace
+
+void lz4_compress(std::string_view in, std::string &out) {
+  const char *src = in.data();
+  const std::size_t size = in.size();
+  // Positions + 1 of recent 4-byte sequences by hash; 0 is empty.
+  std::uint32_t table[1u << hash_bits] = {};
+  std::size_t anchor = 0; // first byte not yet emitted
+  if (size > match_margin) {
+    const std::size_t match_limit = size - match_margin;
+    const std::size_t end_limit = size - last_literals;
+    std::size_t pos = 0;
+    unsigned misses = 0;
+    while (pos < match_limit) {
+      auto sequence = load32(src + pos);
+      auto &slot = table[hash(sequence)];
+      std::size_t candidate = slot;
+      slot = static_cast<std::uint32_t>(pos + 1);
+      if (!candidate || pos + 1 - candidate > max_offset ||
+          load32(src + candidate - 1) != sequence) {
+        // Skip ahead faster through input that does not compress.
+        pos += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+      --candidate;
+      std::size_t length =
+          min_match + common_length(src + candidate + min_match,
+                                    src + pos + min_match, src + end_limit);
+      while (pos > anchor && candidate > 0 &&
+             src[pos - 1] == src[candidate - 1]) {
+        --pos;
+        --candidate;
+        ++length;
+      }
+      put_sequence(out, src + anchor, pos - anchor, pos - candidate, length);
+      pos += length;
+      anchor = pos;
+    }
+  }
+  auto count = size - anchor;
+  out += static_cast<char>(std::min<std::size_t>(count, 15) << 4);
+  if (count >= 15)
+    put_length(out, count - 15);
+  out.append(src + anchor, count);
+}
+
+void lz4_decompress(std::string_view in, char *out, std::size_t size) {
+  std::size_t ip = 0, op = 0;
+  for (;;) {
+    if (ip >= in.size())
+      throw std::runtime_error("Truncated LZ4 block");
+    auto token = static_cast<unsigned char>(in[ip++]);
+    std::size_t count = token >> 4;
+    if (count == 15)
+      count += get_length(in, ip);
+    if (count > in.size() - ip || count > size - op)
+      throw std::runtime_error("LZ4 literals overrun");
+    // Short runs are copied as a fixed 16 bytes where there is room; the
+    // excess is overwritten by what follows.
+    if (count <= 16 && in.size() - ip >= 16 && size - op >= 16)
+      std::memcpy(out + op, in.data() + ip, 16);
+    else
+      std::memcpy(out + op, in.data() + ip, count);
+    ip += count;
+    op += count;
+    if (ip == in.size())
+      break;
+
+    if (in.size() - ip < 2)
+      throw std::runtime_error("Truncated LZ4 block");
+    std::size_t offset = static_cast<unsigned char>(in[ip]) |
+                         static_cast<unsigned char>(in[ip + 1]) << 8;
+    ip += 2;
+    std::size_t length = token & 15;
+    if (length == 15)
+      length += get_length(in, ip);
+    length += min_match;
+    if (offset == 0 || offset > op || length > size - op)
+      throw std::runtime_error("LZ4 match out of range");
+    char *dst = out + op;
+    const char *from = dst - offset;
+    if (offset >= 8 && size - op >= length + 8) {
+      // Eight bytes at a time, each chunk's source already written.
+      for (std::size_t i = 0; i < length; i += 8)
+        std::memcpy(dst + i, from + i, 8);
+    } else if (offset >= length) {
+      std::memcpy(dst, from, length);
+    } else {
+      // The match overlaps what it produces, e.g. a run of one byte.
+      for (std::size_t i = 0; i < length; ++i)
+        dst[i] = from[i];
+    }
+    op += length;
+  }
+  if (op != size)
+    throw std::runtime_error("LZ4 block has the wrong size");
+}
@@ -0,0 +1,19 @@
+#ifndef LZ4_HPP
+#define LZ4_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// LZ4 block format (no frame header or checksum): a greedy single-pass
+// compressor and a bounds-checked decompressor. Fast enough to sit on every
+// doc read and write; see lz4.cpp for the format.
+
+// Append the compressed form of in to out.
+void lz4_compress(std::string_view in, std::string &out);
+
+// Decompress in into the size bytes at out. Throws std::runtime_error unless
+// in is a well-formed block that decompresses to exactly size bytes.
+void lz4_decompress(std::string_view in, char *out, std::size_t size);
+
+#endif // LZ4_HPP
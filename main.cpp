@@ -1,10 +1,15 @@
-#include "base64.hpp"
+#include "chat_hub.hpp"
 #include "database.hpp"
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/insert_linebreaks.hpp>
-#include <boost/archive/iterators/remove_whitespace.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
+#include "db_executor.hpp"
+#include "live_docs.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "migrations.hpp"
+#include "password_hasher.hpp"
+#include "presence.hpp"
+#include "sessions.hpp"
+#include "versions.hpp"
+#include "write_batcher.hpp"
 #include <boost/asio.hpp>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/buffers_iterator.hpp>
@@ -26,69 +31,178 @@
 #include <http_connection.hpp>
 #include <iostream>
 #include <memory>
+#include <options.hpp>
 #include <sqlite3.h>
+#include <thread>
 #include <utility>
+#include <vector>
 
 namespace beast = boost::beast;
 namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;
-using namespace boost::archive::iterators;
 
-Database db = Database("server.db");
+// Loop for accepting new connections. Every connection gets its own strand so
+// its handlers never run concurrently when several threads run the io_context.
+void http_server(tcp::acceptor &acceptor, const ServerContext &context) {
+  acceptor.async_accept(
+      net::make_strand(acceptor.get_executor()),
+      [&acceptor, &context](beast::error_code ec, tcp::socket socket) {
+        if (!ec) {
+          metrics::increment(metrics::Counter::connections_accepted);
+          std::make_shared<http_connection>(std::move(socket), context)
+              ->start();
+        }
+        http_server(acceptor, context);
+      });
+}
 
-// Loop for accepting new connections.
-void http_server(tcp::acceptor &acceptor, tcp::socket &socket) {
-  acceptor.async_accept(socket, [&](beast::error_code ec) {
-    if (!ec)
-      std::make_shared<http_connection>(std::move(socket), &db)->start();
-    http_server(acceptor, socket);
+// Once a second, expire stale presence entries; every snapshot_interval
+// seconds (if non-zero) also save the live ones to online_users.
+void maintain_presence(net::steady_timer &timer, const ServerContext &context,
+                       unsigned int snapshot_interval, unsigned int tick = 0) {
+  timer.expires_after(std::chrono::seconds(1));
+  timer.async_wait([&timer, &context, snapshot_interval,
+                    tick](beast::error_code ec) {
+    if (ec)
+      return;
+    context.presence->expire();
+    unsigned int next_tick = tick + 1;
+    if (snapshot_interval && next_tick % snapshot_interval == 0) {
+      context.db_executor->async_run(
+          [&context] {
+            context.db->upsert_online_users(context.presence->snapshot());
+          },
+          [](std::exception_ptr error) {
+            if (error) {
+              try {
+                std::rethrow_exception(error);
+              } catch (const std::exception &e) {
+                logging::error("Presence snapshot failed: ", e.what());
+              }
+            }
+          });
+    }
+    maintain_presence(timer, context, snapshot_interval, next_tick);
   });
 }
 
-void initialize_db() { // Create tables on db file
-  try {
-    db.execute("CREATE TABLE IF NOT EXISTS docs (id INTEGER PRIMARY KEY, "
-               "workspace TEXT, time INTEGER, date TEXT, title "
-               "TEXT,content TEXT)");
-    db.execute(
-        "CREATE TABLE IF NOT EXISTS workspaces (id INTEGER PRIMARY KEY, name "
-        "TEXT, password TEXT)");
-    db.execute("CREATE TABLE IF NOT EXISTS chat (id INTEGER PRIMARY KEY, time "
-               "INTEGER, "
-               "workspace TEXT, title "
-               "TEXT,content TEXT)");
-    db.execute("CREATE TABLE IF NOT EXISTS online_users (workspace TEXT,"
-               "user_id TEXT, "
-               "last_ping INTEGER, UNIQUE(workspace, user_id))");
-  } catch (const std::exception &e) {
-    std::cerr << e.what() << '\n';
-  }
+// Once a minute, drop expired sessions from memory and from the sessions
+// table.
+void expire_sessions(net::steady_timer &timer, const ServerContext &context) {
+  timer.expires_after(std::chrono::minutes(1));
+  timer.async_wait([&timer, &context](beast::error_code ec) {
+    if (ec)
+      return;
+    auto now = std::time(nullptr);
+    context.sessions->expire(now);
+    context.db_executor->async_run(
+        [&context, now] { context.db->delete_expired_sessions(now); },
+        [](std::exception_ptr error) {
+          if (error) {
+            try {
+              std::rethrow_exception(error);
+            } catch (const std::exception &e) {
+              logging::error("Session purge failed: ", e.what());
+            }
+          }
+        });
+    expire_sessions(timer, context);
+  });
+}
+
+// Acceptor bound with SO_REUSEPORT so every thread can own one.
+static void open_reuseport_acceptor(tcp::acceptor &acceptor,
+                                    const tcp::endpoint &endpoint) {
+  using reuse_port =
+      net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(net::socket_base::reuse_address(true));
+  acceptor.set_option(reuse_port(true));
+  acceptor.bind(endpoint);
+  acceptor.listen(net::socket_base::max_listen_connections);
 }
 
 int main(int argc, char *argv[]) {
   try {
     // Check command line arguments.
-    if (argc != 3) {
-      std::cerr << "Usage: " << argv[0] << " <address> <port>\n";
-      std::cerr << "  For IPv4, try:\n";
-      std::cerr << "    server 0.0.0.0 80\n";
-      std::cerr << "  For IPv6, try:\n";
-      std::cerr << "    server 0::0 80\n";
+    ServerOptions options;
+    try {
+      options = parse_options(argc, argv);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << '\n';
+      print_usage(argv[0]);
       return EXIT_FAILURE;
     }
+    logging::Logger::instance().set_level(options.log_level);
 
-    initialize_db();
+    Database db(options.db_path, options.db_readers);
+    db.set_compress_min(options.compress_min);
+    migrate(db);
 
-    auto const address = net::ip::make_address(argv[1]);
-    unsigned short port = static_cast<unsigned short>(std::atoi(argv[2]));
+    auto const address = net::ip::make_address(options.address);
+    tcp::endpoint const endpoint{address, options.port};
 
-    net::io_context ioc{1};
+    // Blocking SQLite work runs here instead of on the network threads.
+    DbExecutor db_executor{options.db_threads};
+    WriteBatcher write_batcher{
+        db, std::chrono::milliseconds(options.batch_window_ms),
+        options.batch_max};
+    ChatHub chat_hub;
+    PresenceTracker presence{options.presence_window};
+    if (options.presence_snapshot)
+      presence.restore(
+          db.select_online_users(std::time(nullptr) - presence.window()));
+    SessionStore sessions{options.session_ttl};
+    sessions.restore(db.select_sessions(std::time(nullptr)));
+    PasswordHasher password_hasher{options.hash_threads, options.hash_queue,
+                                   options.hash_cost};
+    ContentVersions versions;
+    LiveDocs live_docs{db, write_batcher, versions};
+    ServerContext context{&db,       &db_executor, &write_batcher,
+                          &chat_hub, &presence,    &sessions,
+                          &password_hasher, &live_docs, &versions};
 
-    tcp::acceptor acceptor{ioc, {address, port}};
-    tcp::socket socket{ioc};
-    http_server(acceptor, socket);
+    std::vector<std::thread> threads;
+    threads.reserve(options.threads - 1);
+
+    if (options.mode == ThreadMode::shared) {
+      net::io_context ioc{static_cast<int>(options.threads)};
+
+      tcp::acceptor acceptor{ioc, endpoint};
+      http_server(acceptor, context);
+
+      net::steady_timer presence_timer{ioc};
+      maintain_presence(presence_timer, context, options.presence_snapshot);
+      net::steady_timer session_timer{ioc};
+      expire_sessions(session_timer, context);
+
+      for (unsigned int i = 1; i < options.threads; ++i)
+        threads.emplace_back([&ioc] { ioc.run(); });
+      ioc.run();
+    } else {
+      // One io_context, acceptor and thread per worker; the kernel balances
+      // incoming connections across the listening sockets.
+      std::vector<std::unique_ptr<net::io_context>> contexts;
+      std::vector<std::unique_ptr<tcp::acceptor>> acceptors;
+      for (unsigned int i = 0; i < options.threads; ++i) {
+        contexts.push_back(std::make_unique<net::io_context>(1));
+        acceptors.push_back(std::make_unique<tcp::acceptor>(*contexts.back()));
+        open_reuseport_acceptor(*acceptors.back(), endpoint);
+        http_server(*acceptors.back(), context);
+      }
+
+      net::steady_timer presence_timer{*contexts.front()};
+      maintain_presence(presence_timer, context, options.presence_snapshot);
+      net::steady_timer session_timer{*contexts.front()};
+      expire_sessions(session_timer, context);
+
+      for (unsigned int i = 1; i < options.threads; ++i)
+        threads.emplace_back([&ioc = *contexts[i]] { ioc.run(); });
+      contexts.front()->run();
+    }
 
-    ioc.run();
+    for (auto &thread : threads)
+      thread.join();
   } catch (std::exception const &e) {
     std::cerr << "Error: " << e.what() << std::endl;
     return EXIT_FAILURE;
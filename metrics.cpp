@@ -0,0 +1,251 @@
+#include "metrics.hpp"
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sqlite3.h>
+#include <vector>
+
+namespace metrics {
+namespace {
+
+constexpr std::size_t route_count = static_cast<std::size_t>(Route::count);
+constexpr std::size_t phase_count = static_cast<std::size_t>(Phase::count);
+constexpr std::size_t counter_count = static_cast<std::size_t>(Counter::count);
+constexpr std::size_t gauge_count = static_cast<std::size_t>(Gauge::count);
+constexpr std::size_t sqlite_code_count = 256;
+
+// Log-linear buckets over nanoseconds, HDR style: values up to 4 get a
+// bucket each, then every power of two is split into 4 equal sub-buckets,
+// which keeps the relative error under 25% up to 2^40 ns (about 18 minutes).
+// A bucket includes its upper bound, as a Prometheus le bucket does, so the
+// index is that of value - 1 in buckets that start at their lower bound.
+constexpr unsigned sub_bucket_bits = 2;
+constexpr unsigned sub_buckets = 1u << sub_bucket_bits;
+constexpr unsigned max_exponent = 40;
+constexpr std::size_t bucket_count =
+    sub_buckets + (max_exponent - sub_bucket_bits + 1) * sub_buckets;
+
+std::size_t bucket_index(std::uint64_t value) {
+  if (value)
+    --value;
+  if (value < sub_buckets)
+    return static_cast<std::size_t>(value);
+  unsigned exponent = 63 - __builtin_clzll(value);
+  if (exponent > max_exponent)
+    return bucket_count - 1;
+  unsigned sub = static_cast<unsigned>(value >> (exponent - sub_bucket_bits)) &
+                 (sub_buckets - 1);
+  return sub_buckets + (exponent - sub_bucket_bits) * sub_buckets + sub;
+}
+
+struct Histogram {
+  std::array<std::atomic<std::uint64_t>, bucket_count> buckets{};
+  std::atomic<std::uint64_t> sum{0};
+};
+
+// Only the owning thread writes a shard, so updates are a relaxed load and
+// store rather than a locked read-modify-write.
+void bump(std::atomic<std::uint64_t> &value, std::uint64_t by = 1) {
+  value.store(value.load(std::memory_order_relaxed) + by,
+              std::memory_order_relaxed);
+}
+
+struct Shard {
+  std::array<std::array<Histogram, phase_count>, route_count> histograms;
+  std::array<std::atomic<std::uint64_t>, counter_count> counters{};
+  std::array<std::atomic<std::uint64_t>, sqlite_code_count> sqlite_errors{};
+  clock::duration db_time{0};
+  clock::duration hash_time{0};
+};
+
+std::array<std::atomic<std::int64_t>, gauge_count> gauges{};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<Shard>> registry;
+
+Shard &local_shard() {
+  thread_local Shard *shard = [] {
+    auto owned = std::make_unique<Shard>();
+    Shard *raw = owned.get();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(std::move(owned));
+    return raw;
+  }();
+  return *shard;
+}
+
+const char *route_names[route_count] = {
+    "login",          "logout",         "get_chat",       "post_chat",
+    "list_docs",      "get_doc",        "save_doc",       "edit_doc",
+    "delete_doc",     "list_revisions", "get_revision",   "ping",
+    "online_users",   "metrics",        "websocket",      "not_found"};
+const char *phase_names[phase_count] = {"parse",     "db",    "hash",
+                                        "serialize", "write", "total"};
+const char *counter_names[counter_count] = {
+    "collabchat_connections_accepted_total",
+    "collabchat_connections_closed_total",
+    "collabchat_deadline_expirations_total",
+    "collabchat_websocket_upgrades_total",
+    "collabchat_write_batches_total",
+    "collabchat_batched_writes_total",
+    "collabchat_password_hash_rejections_total",
+    "collabchat_crdt_ops_total",
+    "collabchat_not_modified_total"};
+const char *gauge_names[gauge_count] = {
+    "collabchat_password_hash_queue_depth", "collabchat_live_docs"};
+
+void append_number(std::string &out, std::uint64_t value) {
+  out += std::to_string(value);
+}
+
+void append_seconds(std::string &out, std::uint64_t nanoseconds) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof buffer, "%.9g", nanoseconds / 1e9);
+  out += buffer;
+}
+
+} // namespace
+
+void record(Route route, Phase phase, clock::duration elapsed) {
+  auto nanoseconds = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  auto &histogram = local_shard().histograms[static_cast<std::size_t>(route)]
+                                            [static_cast<std::size_t>(phase)];
+  bump(histogram.buckets[bucket_index(nanoseconds)]);
+  bump(histogram.sum, nanoseconds);
+}
+
+void increment(Counter counter, std::uint64_t by) {
+  bump(local_shard().counters[static_cast<std::size_t>(counter)], by);
+}
+
+void add(Gauge gauge, std::int64_t delta) {
+  gauges[static_cast<std::size_t>(gauge)].fetch_add(delta,
+                                                    std::memory_order_relaxed);
+}
+
+void record_sqlite_error(int rc) {
+  bump(local_shard().sqlite_errors[rc & 0xff]);
+}
+
+clock::duration thread_db_time() { return local_shard().db_time; }
+
+void add_thread_db_time(clock::duration elapsed) {
+  local_shard().db_time += elapsed;
+}
+
+clock::duration thread_hash_time() { return local_shard().hash_time; }
+
+void add_thread_hash_time(clock::duration elapsed) {
+  local_shard().hash_time += elapsed;
+}
+
+void render_prometheus(std::string &out) {
+  // Sum the shards first so the registry lock is held only briefly.
+  auto totals = std::make_unique<Shard>();
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const auto &shard : registry) {
+      for (std::size_t r = 0; r < route_count; ++r) {
+        for (std::size_t p = 0; p < phase_count; ++p) {
+          auto &from = shard->histograms[r][p];
+          auto &to = totals->histograms[r][p];
+          for (std::size_t b = 0; b < bucket_count; ++b)
+            bump(to.buckets[b],
+                 from.buckets[b].load(std::memory_order_relaxed));
+          bump(to.sum, from.sum.load(std::memory_order_relaxed));
+        }
+      }
+      for (std::size_t c = 0; c < counter_count; ++c)
+        bump(totals->counters[c],
+             shard->counters[c].load(std::memory_order_relaxed));
+      for (std::size_t e = 0; e < sqlite_code_count; ++e)
+        bump(totals->sqlite_errors[e],
+             shard->sqlite_errors[e].load(std::memory_order_relaxed));
+    }
+  }
+
+  for (std::size_t c = 0; c < counter_count; ++c) {
+    out += "# TYPE ";
+    out += counter_names[c];
+    out += " counter\n";
+    out += counter_names[c];
+    out += ' ';
+    append_number(out, totals->counters[c].load());
+    out += '\n';
+  }
+
+  for (std::size_t g = 0; g < gauge_count; ++g) {
+    out += "# TYPE ";
+    out += gauge_names[g];
+    out += " gauge\n";
+    out += gauge_names[g];
+    out += ' ';
+    out += std::to_string(gauges[g].load(std::memory_order_relaxed));
+    out += '\n';
+  }
+
+  out += "# TYPE collabchat_sqlite_errors_total counter\n";
+  for (std::size_t e = 0; e < sqlite_code_count; ++e) {
+    auto count = totals->sqlite_errors[e].load();
+    if (!count)
+      continue;
+    out += "collabchat_sqlite_errors_total{code=\"";
+    append_number(out, e);
+    out += "\",error=\"";
+    out += sqlite3_errstr(static_cast<int>(e));
+    out += "\"} ";
+    append_number(out, count);
+    out += '\n';
+  }
+
+  // Prometheus buckets are exported at every power of two from 1us up; the
+  // finer sub-buckets only matter for quantiles computed in-process.
+  out += "# TYPE collabchat_request_phase_seconds histogram\n";
+  for (std::size_t r = 0; r < route_count; ++r) {
+    for (std::size_t p = 0; p < phase_count; ++p) {
+      auto &histogram = totals->histograms[r][p];
+      std::string labels = "route=\"";
+      labels += route_names[r];
+      labels += "\",phase=\"";
+      labels += phase_names[p];
+      labels += '"';
+
+      std::uint64_t cumulative = 0;
+      std::string lines;
+      for (std::size_t b = 0; b < bucket_count; ++b) {
+        cumulative += histogram.buckets[b].load();
+        // Bucket b ends at a power of two when it is the last sub-bucket.
+        if (b < sub_buckets ||
+            (b - sub_buckets) % sub_buckets != sub_buckets - 1)
+          continue;
+        unsigned exponent =
+            static_cast<unsigned>((b - sub_buckets) / sub_buckets) +
+            sub_bucket_bits + 1;
+        if (exponent < 10 || exponent > max_exponent)
+          continue;
+        lines += "collabchat_request_phase_seconds_bucket{" + labels +
+                 ",le=\"";
+        append_seconds(lines, std::uint64_t(1) << exponent);
+        lines += "\"} ";
+        append_number(lines, cumulative);
+        lines += '\n';
+      }
+      if (!cumulative)
+        continue; // never recorded; keep the scrape small
+      out += lines;
+      out += "collabchat_request_phase_seconds_bucket{" + labels +
+             ",le=\"+Inf\"} ";
+      append_number(out, cumulative);
+      out += "\ncollabchat_request_phase_seconds_sum{" + labels + "} ";
+      append_seconds(out, histogram.sum.load());
+      out += "\ncollabchat_request_phase_seconds_count{" + labels + "} ";
+      append_number(out, cumulative);
+      out += '\n';
+    }
+  }
+}
+
+} // namespace metrics
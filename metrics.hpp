@@ -0,0 +1,81 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Process-wide instrumentation. Every thread records into its own shard of
+// plain atomics, so recording never contends; a scrape sums all shards.
+namespace metrics {
+
+enum class Route {
+  login,
+  logout,
+  get_chat,
+  post_chat,
+  list_docs,
+  get_doc,
+  save_doc,
+  edit_doc,
+  delete_doc,
+  list_revisions,
+  get_revision,
+  ping,
+  online_users,
+  metrics,
+  websocket,
+  not_found,
+  count
+};
+
+// Where a request spends its time: parsing headers and body, inside Database
+// calls, hashing passwords, building the response around them, and writing
+// it out. total runs from a complete request to a written response.
+enum class Phase { parse, db, hash, serialize, write, total, count };
+
+enum class Counter {
+  connections_accepted,
+  connections_closed,
+  deadline_expirations,
+  websocket_upgrades,
+  write_batches,   // group commits
+  batched_writes,  // requests committed by them
+  hash_rejections, // logins turned away because the hash queue was full
+  crdt_ops,        // edits applied to live docs
+  not_modified,    // conditional GETs answered 304 without a query
+  count
+};
+
+// Current levels rather than running totals. Unlike counters they are one
+// process-wide atomic each, since a level cannot be summed from shards.
+enum class Gauge {
+  hash_queue_depth, // password hashing jobs waiting for a thread
+  live_docs,        // docs open for live editing
+  count
+};
+
+using clock = std::chrono::steady_clock;
+
+void record(Route route, Phase phase, clock::duration elapsed);
+void increment(Counter counter, std::uint64_t by = 1);
+void add(Gauge gauge, std::int64_t delta);
+
+// Count a failed SQLite call by its primary result code (SQLITE_BUSY, ...).
+void record_sqlite_error(int rc);
+
+// Time this thread has spent inside Database calls. The difference across a
+// handler is that handler's db phase.
+clock::duration thread_db_time();
+void add_thread_db_time(clock::duration elapsed);
+
+// Likewise for time spent hashing passwords: a handler's hash phase.
+clock::duration thread_hash_time();
+void add_thread_hash_time(clock::duration elapsed);
+
+// Append every metric in Prometheus text exposition format.
+void render_prometheus(std::string &out);
+
+} // namespace metrics
+
+#endif // METRICS_HPP
@@ -0,0 +1,104 @@
+#include "migrations.hpp"
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+struct Migration {
+  int version;
+  const char *description;
+  const char *sql;
+};
+
+// Append new migrations at the end; never edit one that has shipped.
+const Migration migrations[] = {
+    {1, "create tables",
+     // IF NOT EXISTS so databases created before versioning adopt it.
+     "CREATE TABLE IF NOT EXISTS docs (id INTEGER PRIMARY KEY, "
+     "workspace TEXT, time INTEGER, date TEXT, title TEXT, content TEXT);"
+     "CREATE TABLE IF NOT EXISTS workspaces (id INTEGER PRIMARY KEY, "
+     "name TEXT, password TEXT);"
+     "CREATE TABLE IF NOT EXISTS chat (id INTEGER PRIMARY KEY, time INTEGER, "
+     "workspace TEXT, title TEXT, content TEXT);"
+     "CREATE TABLE IF NOT EXISTS online_users (workspace TEXT, user_id TEXT, "
+     "last_ping INTEGER, UNIQUE(workspace, user_id));"},
+    {2, "index workspace lookups",
+     // Chat history is read per workspace in time order.
+     "CREATE INDEX IF NOT EXISTS chat_workspace_time "
+     "ON chat (workspace, time);"
+     // Doc listings only need id (the rowid) and title, so these cover them.
+     "CREATE INDEX IF NOT EXISTS docs_workspace_time "
+     "ON docs (workspace, time, title);"
+     "CREATE INDEX IF NOT EXISTS docs_workspace_date_time "
+     "ON docs (workspace, date, time, title);"
+     "CREATE INDEX IF NOT EXISTS workspaces_name ON workspaces (name);"},
+    {3, "index chat by id cursor",
+     // Chat pages are cut by id, which replaces the time ordering.
+     "CREATE INDEX IF NOT EXISTS chat_workspace_id ON chat (workspace, id);"
+     "DROP INDEX IF EXISTS chat_workspace_time;"},
+    {4, "create sessions",
+     // Looked up by token only when restoring; the index serves the purge.
+     "CREATE TABLE sessions (token TEXT PRIMARY KEY, workspace TEXT NOT NULL, "
+     "expires INTEGER NOT NULL) WITHOUT ROWID;"
+     "CREATE INDEX sessions_expires ON sessions (expires);"},
+    {5, "create doc_ops",
+     // Edits not yet folded into docs.content, in revision order. The newest
+     // row also holds the doc's revision and content length, so an edit
+     // never has to read or rewrite the docs row.
+     "CREATE TABLE doc_ops (doc_id INTEGER NOT NULL, "
+     "revision INTEGER NOT NULL, length INTEGER NOT NULL, ops BLOB NOT NULL, "
+     "PRIMARY KEY (doc_id, revision));"},
+    {6, "create crdt tables",
+     // Docs edited live: a snapshot of each one's CRDT, taken when its text
+     // was last saved to docs, and the ops applied since, in order.
+     "CREATE TABLE crdt_snapshots (doc_id INTEGER PRIMARY KEY, "
+     "revision INTEGER NOT NULL, seq INTEGER NOT NULL, state BLOB NOT NULL);"
+     "CREATE TABLE crdt_ops (doc_id INTEGER NOT NULL, seq INTEGER NOT NULL, "
+     "op BLOB NOT NULL, PRIMARY KEY (doc_id, seq)) WITHOUT ROWID;"},
+    {7, "create doc_revisions",
+     // Every revision of every doc. depth 0 rows hold the content itself,
+     // stored as docs.content is; the rest hold a delta from the revision
+     // before and count how many deltas back the last of those was.
+     "CREATE TABLE doc_revisions (doc_id INTEGER NOT NULL, "
+     "revision INTEGER NOT NULL, time INTEGER NOT NULL, "
+     "length INTEGER NOT NULL, depth INTEGER NOT NULL, data BLOB NOT NULL, "
+     "PRIMARY KEY (doc_id, revision));"},
+};
+
+int user_version(Database &db) {
+  return static_cast<int>(db.query_int64("PRAGMA user_version"));
+}
+
+} // namespace
+
+int latest_schema_version() {
+  return std::end(migrations)[-1].version;
+}
+
+void migrate(Database &db) {
+  int current = user_version(db);
+  for (const auto &migration : migrations) {
+    if (migration.version <= current)
+      continue;
+
+    std::cerr << "Applying schema migration " << migration.version << " ("
+              << migration.description << ")\n";
+    try {
+      db.execute(std::string("BEGIN IMMEDIATE;") + migration.sql +
+                 "PRAGMA user_version = " + std::to_string(migration.version) +
+                 ";COMMIT;");
+    } catch (const std::exception &e) {
+      try {
+        db.execute("ROLLBACK");
+      } catch (const std::exception &) {
+        // BEGIN itself failed, so there is nothing to roll back.
+      }
+      throw std::runtime_error("Schema migration " +
+                               std::to_string(migration.version) +
+                               " failed: " + e.what());
+    }
+    current = migration.version;
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef MIGRATIONS_HPP
+#define MIGRATIONS_HPP
+
+#include "database.hpp"
+
+// Bring the schema up to the latest version. The version reached so far is
+// kept in PRAGMA user_version, and each pending migration runs in its own
+// transaction together with the version bump. Throws std::runtime_error if a
+// migration fails; the database is left at the last version that succeeded.
+void migrate(Database &db);
+
+// The version migrate() brings the schema to.
+int latest_schema_version();
+
+#endif // MIGRATIONS_HPP
@@ -0,0 +1,143 @@
+#include "options.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// Split "--key=value" into its parts; returns false for anything else.
+bool split_flag(const std::string &arg, std::string &key, std::string &value) {
+  if (arg.rfind("--", 0) != 0)
+    return false;
+  auto eq = arg.find('=');
+  if (eq == std::string::npos)
+    return false;
+  key = arg.substr(2, eq - 2);
+  value = arg.substr(eq + 1);
+  return true;
+}
+
+unsigned int parse_threads(const std::string &value) {
+  if (value == "auto") {
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores ? cores : 1;
+  }
+  unsigned long threads = std::stoul(value);
+  if (threads == 0)
+    throw std::invalid_argument("Thread count must be at least 1");
+  return static_cast<unsigned int>(threads);
+}
+
+ThreadMode parse_mode(const std::string &value) {
+  if (value == "shared")
+    return ThreadMode::shared;
+  if (value == "reuseport")
+    return ThreadMode::reuseport;
+  throw std::invalid_argument("Unknown --mode: " + value);
+}
+
+unsigned int parse_batch_max(const std::string &value) {
+  unsigned long rows = std::stoul(value);
+  if (rows == 0)
+    throw std::invalid_argument("Batch size must be at least 1");
+  return static_cast<unsigned int>(rows);
+}
+
+unsigned int parse_hash_cost(const std::string &value) {
+  unsigned long cost = std::stoul(value);
+  if (cost < 1 || cost > 24)
+    throw std::invalid_argument("Hash cost must be between 1 and 24");
+  return static_cast<unsigned int>(cost);
+}
+
+} // namespace
+
+ServerOptions parse_options(int argc, char *argv[]) {
+  if (argc < 3)
+    throw std::invalid_argument("Missing <address> <port>");
+
+  ServerOptions options;
+  options.address = argv[1];
+  options.port = static_cast<unsigned short>(std::atoi(argv[2]));
+
+  for (int i = 3; i < argc; ++i) {
+    std::string key, value;
+    if (!split_flag(argv[i], key, value))
+      throw std::invalid_argument(std::string("Unexpected argument: ") +
+                                  argv[i]);
+    if (key == "threads")
+      options.threads = parse_threads(value);
+    else if (key == "mode")
+      options.mode = parse_mode(value);
+    else if (key == "db")
+      options.db_path = value;
+    else if (key == "db-threads")
+      options.db_threads = parse_threads(value);
+    else if (key == "db-readers")
+      options.db_readers = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "compress-min")
+      options.compress_min = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "presence-window")
+      options.presence_window = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "presence-snapshot")
+      options.presence_snapshot = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "session-ttl")
+      options.session_ttl = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "hash-threads")
+      options.hash_threads = parse_threads(value);
+    else if (key == "hash-queue")
+      options.hash_queue = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "hash-cost")
+      options.hash_cost = parse_hash_cost(value);
+    else if (key == "batch-window-ms")
+      options.batch_window_ms = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "batch-max")
+      options.batch_max = parse_batch_max(value);
+    else if (key == "log-level")
+      options.log_level = logging::parse_severity(value);
+    else
+      throw std::invalid_argument("Unknown option: --" + key);
+  }
+  return options;
+}
+
+void print_usage(const char *program) {
+  std::cerr << "Usage: " << program << " <address> <port> [options]\n";
+  std::cerr << "  For IPv4, try:\n";
+  std::cerr << "    server 0.0.0.0 80\n";
+  std::cerr << "  For IPv6, try:\n";
+  std::cerr << "    server 0::0 80\n";
+  std::cerr << "Options:\n";
+  std::cerr << "  --threads=N|auto          worker threads (default 1)\n";
+  std::cerr << "  --mode=shared|reuseport   one io_context shared by all "
+               "threads, or one io_context and SO_REUSEPORT acceptor per "
+               "thread (default shared)\n";
+  std::cerr << "  --db=PATH                 SQLite database file "
+               "(default server.db)\n";
+  std::cerr << "  --db-threads=N|auto       database worker threads "
+               "(default 4)\n";
+  std::cerr << "  --db-readers=N            read-only SQLite connections; 0 "
+               "keeps every query on the writer (default 4)\n";
+  std::cerr << "  --compress-min=BYTES      store doc content this long or "
+               "longer compressed; 0 never compresses (default 512)\n";
+  std::cerr << "  --presence-window=S       seconds a user stays online after "
+               "a ping (default 20)\n";
+  std::cerr << "  --presence-snapshot=S     save presence to online_users "
+               "every S seconds; 0 disables (default 0)\n";
+  std::cerr << "  --session-ttl=S           seconds a login session lasts "
+               "(default 604800)\n";
+  std::cerr << "  --hash-threads=N|auto     password hashing threads "
+               "(default 2)\n";
+  std::cerr << "  --hash-queue=N            logins that may wait for a hashing "
+               "thread before more get 503 (default 64)\n";
+  std::cerr << "  --hash-cost=LOG2N         scrypt cost; existing passwords "
+               "are rehashed at their next login (default 14)\n";
+  std::cerr << "  --batch-window-ms=MS      how long a write batch waits for "
+               "more writes before committing; 0 commits what is queued "
+               "(default 2)\n";
+  std::cerr << "  --batch-max=N             most writes per batch "
+               "(default 256)\n";
+  std::cerr << "  --log-level=LEVEL         debug, info, warning or error "
+               "(default info)\n";
+}
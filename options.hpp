@@ -0,0 +1,48 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include "logger.hpp"
+#include <string>
+
+// How worker threads share the listening socket.
+enum class ThreadMode {
+  shared,   // N threads run one io_context; connections are serialized by
+            // their own strand.
+  reuseport // One single-threaded io_context per thread, each with its own
+            // SO_REUSEPORT acceptor so the kernel spreads connections.
+};
+
+struct ServerOptions {
+  std::string address;
+  unsigned short port = 0;
+  unsigned int threads = 1;
+  ThreadMode mode = ThreadMode::shared;
+  std::string db_path = "server.db";
+  unsigned int db_threads = 4;
+  unsigned int db_readers = 4;
+  // Doc content at least this long is stored compressed; 0 turns it off.
+  unsigned int compress_min = 512;
+  // Seconds a user counts as online after a ping.
+  unsigned int presence_window = 20;
+  // Seconds between presence snapshots to online_users; 0 disables them.
+  unsigned int presence_snapshot = 0;
+  // Seconds a login session stays valid.
+  unsigned int session_ttl = 7 * 24 * 60 * 60;
+  // Password hashing: threads, how many logins may wait for them, and the
+  // scrypt cost as log2(N).
+  unsigned int hash_threads = 2;
+  unsigned int hash_queue = 64;
+  unsigned int hash_cost = 14;
+  // Group commit: how long a write batch stays open, and its size cap.
+  unsigned int batch_window_ms = 2;
+  unsigned int batch_max = 256;
+  logging::Severity log_level = logging::Severity::info;
+};
+
+// Parse "<address> <port> [--key=value...]"; see print_usage for the keys.
+// Throws std::invalid_argument on malformed input.
+ServerOptions parse_options(int argc, char *argv[]);
+
+void print_usage(const char *program);
+
+#endif // OPTIONS_HPP
@@ -0,0 +1,161 @@
+#include "password_hasher.hpp"
+#include "base64.hpp"
+#include "metrics.hpp"
+#include "random.hpp"
+#include "scrypt.hpp"
+#include <charconv>
+
+namespace {
+
+constexpr std::string_view scheme = "$scrypt$";
+constexpr unsigned block_size = 8; // r
+constexpr unsigned parallelism = 1; // p
+constexpr std::size_t salt_size = 16;
+constexpr std::size_t key_size = 32;
+
+struct ScryptHash {
+  unsigned cost = 0;
+  unsigned r = 0;
+  unsigned p = 0;
+  std::string_view salt;
+  std::string_view key;
+};
+
+// Consume "<name>=<number>" and the separator after it from text.
+bool parse_parameter(std::string_view &text, std::string_view name,
+                     char separator, unsigned &value) {
+  if (text.substr(0, name.size()) != name || text.size() <= name.size() ||
+      text[name.size()] != '=')
+    return false;
+  auto first = text.data() + name.size() + 1;
+  auto last = text.data() + text.size();
+  auto [end, error] = std::from_chars(first, last, value);
+  if (error != std::errc() || end == last || *end != separator)
+    return false;
+  text.remove_prefix(static_cast<std::size_t>(end + 1 - text.data()));
+  return true;
+}
+
+// Split a hash() result into its fields; false if stored is not one.
+bool parse_hash(std::string_view stored, ScryptHash &hash) {
+  if (stored.substr(0, scheme.size()) != scheme)
+    return false;
+  stored.remove_prefix(scheme.size());
+  if (!parse_parameter(stored, "ln", ',', hash.cost) ||
+      !parse_parameter(stored, "r", ',', hash.r) ||
+      !parse_parameter(stored, "p", '$', hash.p))
+    return false;
+  auto dollar = stored.find('$');
+  if (dollar == std::string_view::npos)
+    return false;
+  hash.salt = stored.substr(0, dollar);
+  hash.key = stored.substr(dollar + 1);
+  // Bounds keep a corrupt row from asking for absurd amounts of memory.
+  return hash.cost >= 1 && hash.cost <= 24 && hash.r >= 1 && hash.r <= 32 &&
+         hash.p >= 1 && hash.p <= 16;
+}
+
+// Compare without an early exit, so the time taken says nothing about how
+// much of the key matched.
+bool same_bytes(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  unsigned char diff = 0;
+  for (std::size_t i = 0; i < a.size(); ++i)
+    diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+  return diff == 0;
+}
+
+// Passwords stored by the old encoder have a line break after every 72
+// characters; compare as if they did not.
+bool same_base64(std::string_view stored, std::string_view encoded) {
+  std::size_t matched = 0;
+  for (char c : stored) {
+    if (c == '\n')
+      continue;
+    if (matched == encoded.size() || encoded[matched++] != c)
+      return false;
+  }
+  return matched == encoded.size();
+}
+
+std::string timed_scrypt(std::string_view password, std::string_view salt,
+                         unsigned cost, unsigned r, unsigned p,
+                         std::size_t length) {
+  auto started = metrics::clock::now();
+  auto key = scrypt(password, salt, std::uint64_t(1) << cost, r, p, length);
+  metrics::add_thread_hash_time(metrics::clock::now() - started);
+  return key;
+}
+
+} // namespace
+
+PasswordHasher::PasswordHasher(std::size_t threads, std::size_t max_queue,
+                               unsigned cost)
+    : max_queue(max_queue), cost(cost), pool(threads) {}
+
+PasswordHasher::~PasswordHasher() {
+  pool.stop();
+  pool.join();
+}
+
+bool PasswordHasher::enqueue() {
+  auto depth = queued.load(std::memory_order_relaxed);
+  do {
+    if (depth >= max_queue) {
+      metrics::increment(metrics::Counter::hash_rejections);
+      return false;
+    }
+  } while (!queued.compare_exchange_weak(depth, depth + 1,
+                                         std::memory_order_relaxed));
+  metrics::add(metrics::Gauge::hash_queue_depth, 1);
+  return true;
+}
+
+void PasswordHasher::dequeue() {
+  queued.fetch_sub(1, std::memory_order_relaxed);
+  metrics::add(metrics::Gauge::hash_queue_depth, -1);
+}
+
+std::string PasswordHasher::hash(std::string_view password) const {
+  char salt[salt_size];
+  fill_random(salt, sizeof salt);
+  std::string_view salt_bytes(salt, sizeof salt);
+  auto key = timed_scrypt(password, salt_bytes, cost, block_size, parallelism,
+                          key_size);
+
+  std::string stored(scheme);
+  stored += "ln=" + std::to_string(cost) +
+            ",r=" + std::to_string(block_size) +
+            ",p=" + std::to_string(parallelism) + '$';
+  stored += Base64::encode(salt_bytes);
+  stored += '$';
+  stored += Base64::encode(key);
+  return stored;
+}
+
+bool PasswordHasher::verify(std::string_view password,
+                            std::string_view stored) const {
+  ScryptHash parsed;
+  if (!parse_hash(stored, parsed))
+    return same_base64(stored, Base64::encode(password));
+
+  std::string salt, key;
+  try {
+    Base64::decode(parsed.salt, salt);
+    Base64::decode(parsed.key, key);
+  } catch (const std::invalid_argument &) {
+    return false;
+  }
+  if (key.empty())
+    return false;
+  return same_bytes(timed_scrypt(password, salt, parsed.cost, parsed.r,
+                                 parsed.p, key.size()),
+                    key);
+}
+
+bool PasswordHasher::needs_rehash(std::string_view stored) const {
+  ScryptHash parsed;
+  return !parse_hash(stored, parsed) || parsed.cost != cost ||
+         parsed.r != block_size || parsed.p != parallelism;
+}
@@ -0,0 +1,89 @@
+#ifndef PASSWORD_HASHER_HPP
+#define PASSWORD_HASHER_HPP
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace net = boost::asio;
+
+// Passwords are stored as scrypt hashes, which take tens of milliseconds and
+// megabytes of memory each on purpose. Work that hashes runs on this small
+// pool of its own, never on a network thread or a DB worker. At most
+// max_queue jobs may wait for a thread; beyond that a job fails straight away
+// with Overloaded, so a burst of logins is turned away instead of building an
+// ever longer queue.
+class PasswordHasher {
+public:
+  class Overloaded : public std::runtime_error {
+  public:
+    Overloaded() : std::runtime_error("Password hashing queue is full") {}
+  };
+
+  // cost is log2 of the scrypt N parameter.
+  PasswordHasher(std::size_t threads, std::size_t max_queue, unsigned cost);
+  ~PasswordHasher();
+
+  PasswordHasher(const PasswordHasher &) = delete;
+  PasswordHasher &operator=(const PasswordHasher &) = delete;
+
+  // Run fn on a hashing thread, then complete with void(std::exception_ptr)
+  // on the executor associated with token. Completes with Overloaded without
+  // running fn if the queue is full.
+  template <class Function, class CompletionToken>
+  auto async_run(Function fn, CompletionToken &&token) {
+    return net::async_initiate<CompletionToken, void(std::exception_ptr)>(
+        [this](auto handler, Function fn) {
+          if (!enqueue()) {
+            auto ex = net::get_associated_executor(handler);
+            net::post(ex, [handler = std::move(handler)]() mutable {
+              handler(std::make_exception_ptr(Overloaded()));
+            });
+            return;
+          }
+          net::post(pool, [this, fn = std::move(fn),
+                           handler = std::move(handler)]() mutable {
+            dequeue();
+            std::exception_ptr error;
+            try {
+              fn();
+            } catch (...) {
+              error = std::current_exception();
+            }
+            auto ex = net::get_associated_executor(handler);
+            net::post(ex, [handler = std::move(handler), error]() mutable {
+              handler(error);
+            });
+          });
+        },
+        token, std::move(fn));
+  }
+
+  // A new salted hash of password, as
+  // "$scrypt$ln=<cost>,r=8,p=1$<salt>$<key>" with salt and key in Base64.
+  std::string hash(std::string_view password) const;
+
+  // Whether password matches stored: a hash() result, or the Base64 encoding
+  // of the password that accounts from before hashing still have.
+  bool verify(std::string_view password, std::string_view stored) const;
+
+  // Whether stored should be replaced with a fresh hash() once the password
+  // has been verified: it is legacy Base64 or was hashed at another cost.
+  bool needs_rehash(std::string_view stored) const;
+
+private:
+  bool enqueue();
+  void dequeue();
+
+  const std::size_t max_queue;
+  const unsigned cost;
+  std::atomic<std::size_t> queued{0};
+  net::thread_pool pool;
+};
+
+#endif // PASSWORD_HASHER_HPP
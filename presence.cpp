@@ -0,0 +1,99 @@
+#include "presence.hpp"
+#include <algorithm>
+#include <functional>
+
+PresenceTracker::PresenceTracker(std::time_t window) : window_(window) {
+  std::time_t now = std::time(nullptr);
+  for (auto &shard : shards) {
+    // One slot per second of the window plus the current second.
+    shard.wheel.resize(static_cast<std::size_t>(window_) + 2);
+    shard.swept_until = now;
+  }
+}
+
+PresenceTracker::Shard &
+PresenceTracker::shard_for(const std::string &workspace) const {
+  return shards[std::hash<std::string>{}(workspace) % shard_count];
+}
+
+void PresenceTracker::ping(const std::string &workspace,
+                           const std::string &user_id, std::time_t when) {
+  auto &shard = shard_for(workspace);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto &last_ping = shard.workspaces[workspace][user_id];
+  if (last_ping == when)
+    return; // already scheduled for this second
+  last_ping = when;
+  std::time_t expires = std::max(when + window_ + 1, shard.swept_until + 1);
+  shard.wheel[expires % shard.wheel.size()].push_back({workspace, user_id});
+}
+
+void PresenceTracker::for_each_online(
+    const std::string &workspace,
+    const std::function<void(std::string_view user_id)> &visit) const {
+  std::time_t cutoff = std::time(nullptr) - window_;
+  auto &shard = shard_for(workspace);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.workspaces.find(workspace);
+  if (found == shard.workspaces.end())
+    return;
+  for (const auto &user : found->second) {
+    if (user.second >= cutoff)
+      visit(user.first);
+  }
+}
+
+void PresenceTracker::expire(std::time_t now) {
+  for (auto &shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Never sweep more than one lap; older slots are covered by it.
+    auto lap = static_cast<std::time_t>(shard.wheel.size());
+    if (now - shard.swept_until > lap)
+      shard.swept_until = now - lap;
+    for (; shard.swept_until < now; ++shard.swept_until) {
+      std::time_t second = shard.swept_until + 1;
+      auto &slot = shard.wheel[second % shard.wheel.size()];
+      std::vector<Key> kept;
+      for (auto &key : slot) {
+        auto workspace = shard.workspaces.find(key.workspace);
+        if (workspace == shard.workspaces.end())
+          continue;
+        auto user = workspace->second.find(key.user_id);
+        if (user == workspace->second.end())
+          continue;
+        std::time_t expires = user->second + window_ + 1;
+        if (expires <= second) {
+          workspace->second.erase(user);
+          if (workspace->second.empty())
+            shard.workspaces.erase(workspace);
+        } else if (expires % shard.wheel.size() ==
+                   second % shard.wheel.size()) {
+          // Scheduled a full lap ahead (the sweep was late); keep it here.
+          kept.push_back(std::move(key));
+        }
+        // Otherwise a newer ping scheduled the key in another slot.
+      }
+      slot = std::move(kept);
+    }
+  }
+}
+
+std::vector<OnlineUser> PresenceTracker::snapshot() const {
+  std::time_t cutoff = std::time(nullptr) - window_;
+  std::vector<OnlineUser> users;
+  for (auto &shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto &workspace : shard.workspaces) {
+      for (const auto &user : workspace.second) {
+        if (user.second >= cutoff)
+          users.push_back({workspace.first, user.first, user.second});
+      }
+    }
+  }
+  return users;
+}
+
+void PresenceTracker::restore(const std::vector<OnlineUser> &users) {
+  for (const auto &user : users)
+    ping(user.workspace, user.user_id, user.last_ping);
+}
@@ -0,0 +1,70 @@
+#ifndef PRESENCE_HPP
+#define PRESENCE_HPP
+
+#include "database.hpp"
+#include <array>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// In-memory record of which users pinged each workspace recently, so the ping
+// path never touches SQLite. Workspaces are spread over independently locked
+// shards; each shard expires its entries with a one-second timer wheel.
+class PresenceTracker {
+public:
+  explicit PresenceTracker(std::time_t window = 20);
+
+  PresenceTracker(const PresenceTracker &) = delete;
+  PresenceTracker &operator=(const PresenceTracker &) = delete;
+
+  // How many seconds a user stays online after their last ping.
+  std::time_t window() const { return window_; }
+
+  void ping(const std::string &workspace, const std::string &user_id,
+            std::time_t when = std::time(nullptr));
+
+  // Calls visit for each user of workspace that pinged within the window,
+  // with the shard locked; visit must not call back into the tracker.
+  void for_each_online(
+      const std::string &workspace,
+      const std::function<void(std::string_view user_id)> &visit) const;
+
+  // Forget users whose window has passed. Call about once a second.
+  void expire(std::time_t now = std::time(nullptr));
+
+  // Every entry still inside the window, e.g. for writing to online_users.
+  std::vector<OnlineUser> snapshot() const;
+
+  // Seed the tracker from a snapshot taken before a restart.
+  void restore(const std::vector<OnlineUser> &users);
+
+private:
+  static constexpr std::size_t shard_count = 16;
+
+  struct Key {
+    std::string workspace;
+    std::string user_id;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<std::string,
+                       std::unordered_map<std::string, std::time_t>>
+        workspaces;
+    // wheel[t % size] lists the pings that expire at second t. A key may
+    // appear several times; only the slot matching its latest ping removes it.
+    std::vector<std::vector<Key>> wheel;
+    std::time_t swept_until = 0;
+  };
+
+  Shard &shard_for(const std::string &workspace) const;
+
+  std::time_t window_;
+  mutable std::array<Shard, shard_count> shards;
+};
+
+#endif // PRESENCE_HPP
@@ -0,0 +1,18 @@
+#include "random.hpp"
+#include <cerrno>
+#include <stdexcept>
+#include <sys/random.h>
+
+void fill_random(void *buffer, std::size_t size) {
+  auto bytes = static_cast<unsigned char *>(buffer);
+  while (size) {
+    ssize_t n = getrandom(bytes, size, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error("getrandom failed");
+    }
+    bytes += n;
+    size -= static_cast<std::size_t>(n);
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+#include <cstddef>
+
+// Fill buffer with bytes from the kernel CSPRNG. Throws std::runtime_error
+// if it cannot be read.
+void fill_random(void *buffer, std::size_t size);
+
+#endif // RANDOM_HPP
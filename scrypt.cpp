@@ -0,0 +1,307 @@
+#include "scrypt.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+class Sha256 {
+public:
+  static constexpr std::size_t block_size = 64;
+  static constexpr std::size_t digest_size = 32;
+  using Digest = std::array<unsigned char, digest_size>;
+
+  void update(const void *data, std::size_t size) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    length += size;
+    if (buffered) {
+      std::size_t take = std::min(size, block_size - buffered);
+      std::memcpy(buffer + buffered, bytes, take);
+      buffered += take;
+      bytes += take;
+      size -= take;
+      if (buffered < block_size)
+        return;
+      compress(buffer);
+      buffered = 0;
+    }
+    for (; size >= block_size; bytes += block_size, size -= block_size)
+      compress(bytes);
+    std::memcpy(buffer, bytes, size);
+    buffered = size;
+  }
+
+  Digest finish() {
+    std::uint64_t bits = length * 8;
+    unsigned char pad[block_size + 8] = {0x80};
+    std::size_t pad_size = buffered < 56 ? 56 - buffered : 120 - buffered;
+    for (int i = 0; i < 8; ++i)
+      pad[pad_size + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+    update(pad, pad_size + 8);
+    Digest digest;
+    for (int i = 0; i < 8; ++i)
+      for (int j = 0; j < 4; ++j)
+        digest[4 * i + j] =
+            static_cast<unsigned char>(state[i] >> (24 - 8 * j));
+    return digest;
+  }
+
+private:
+  static std::uint32_t rotr(std::uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void compress(const unsigned char *block) {
+    static constexpr std::uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    std::uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+      w[i] = std::uint32_t(block[4 * i]) << 24 |
+             std::uint32_t(block[4 * i + 1]) << 16 |
+             std::uint32_t(block[4 * i + 2]) << 8 | block[4 * i + 3];
+    for (int i = 16; i < 64; ++i) {
+      auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    auto a = state[0], b = state[1], c = state[2], d = state[3];
+    auto e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                ((e & f) ^ (~e & g)) + k[i] + w[i];
+      auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+
+  std::uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  unsigned char buffer[block_size];
+  std::size_t buffered = 0;
+  std::uint64_t length = 0;
+};
+
+// HMAC-SHA256 with the padded keys hashed once, so that PBKDF2 can restart
+// from them for every block.
+class HmacSha256 {
+public:
+  explicit HmacSha256(std::string_view key) {
+    unsigned char block[Sha256::block_size] = {};
+    if (key.size() > Sha256::block_size) {
+      Sha256 hash;
+      hash.update(key.data(), key.size());
+      auto digest = hash.finish();
+      std::memcpy(block, digest.data(), digest.size());
+    } else {
+      std::memcpy(block, key.data(), key.size());
+    }
+    unsigned char pad[Sha256::block_size];
+    for (std::size_t i = 0; i < Sha256::block_size; ++i)
+      pad[i] = block[i] ^ 0x36;
+    inner.update(pad, sizeof pad);
+    for (std::size_t i = 0; i < Sha256::block_size; ++i)
+      pad[i] = block[i] ^ 0x5c;
+    outer.update(pad, sizeof pad);
+  }
+
+  Sha256 begin() const { return inner; }
+
+  Sha256::Digest finish(Sha256 &message) const {
+    auto digest = message.finish();
+    Sha256 hash = outer;
+    hash.update(digest.data(), digest.size());
+    return hash.finish();
+  }
+
+private:
+  Sha256 inner;
+  Sha256 outer;
+};
+
+void pbkdf2(std::string_view password, std::string_view salt,
+            std::uint64_t iterations, unsigned char *out, std::size_t length) {
+  HmacSha256 hmac(password);
+  for (std::uint32_t block = 1; length; ++block) {
+    unsigned char index[4] = {
+        static_cast<unsigned char>(block >> 24),
+        static_cast<unsigned char>(block >> 16),
+        static_cast<unsigned char>(block >> 8),
+        static_cast<unsigned char>(block)};
+    auto message = hmac.begin();
+    message.update(salt.data(), salt.size());
+    message.update(index, sizeof index);
+    auto u = hmac.finish(message);
+    auto t = u;
+    for (std::uint64_t i = 1; i < iterations; ++i) {
+      message = hmac.begin();
+      message.update(u.data(), u.size());
+      u = hmac.finish(message);
+      for (std::size_t j = 0; j < t.size(); ++j)
+        t[j] ^= u[j];
+    }
+    std::size_t take = std::min(length, t.size());
+    std::memcpy(out, t.data(), take);
+    out += take;
+    length -= take;
+  }
+}
+
+std::uint32_t rotl(std::uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+// B ^= X, then B = Salsa20/8(B).
+void salsa20_8_xor(std::uint32_t b[16], const std::uint32_t x[16]) {
+  std::uint32_t w[16];
+  for (int i = 0; i < 16; ++i)
+    w[i] = b[i] ^= x[i];
+  for (int i = 0; i < 8; i += 2) {
+    w[4] ^= rotl(w[0] + w[12], 7);
+    w[8] ^= rotl(w[4] + w[0], 9);
+    w[12] ^= rotl(w[8] + w[4], 13);
+    w[0] ^= rotl(w[12] + w[8], 18);
+    w[9] ^= rotl(w[5] + w[1], 7);
+    w[13] ^= rotl(w[9] + w[5], 9);
+    w[1] ^= rotl(w[13] + w[9], 13);
+    w[5] ^= rotl(w[1] + w[13], 18);
+    w[14] ^= rotl(w[10] + w[6], 7);
+    w[2] ^= rotl(w[14] + w[10], 9);
+    w[6] ^= rotl(w[2] + w[14], 13);
+    w[10] ^= rotl(w[6] + w[2], 18);
+    w[3] ^= rotl(w[15] + w[11], 7);
+    w[7] ^= rotl(w[3] + w[15], 9);
+    w[11] ^= rotl(w[7] + w[3], 13);
+    w[15] ^= rotl(w[11] + w[7], 18);
+
+    w[1] ^= rotl(w[0] + w[3], 7);
+    w[2] ^= rotl(w[1] + w[0], 9);
+    w[3] ^= rotl(w[2] + w[1], 13);
+    w[0] ^= rotl(w[3] + w[2], 18);
+    w[6] ^= rotl(w[5] + w[4], 7);
+    w[7] ^= rotl(w[6] + w[5], 9);
+    w[4] ^= rotl(w[7] + w[6], 13);
+    w[5] ^= rotl(w[4] + w[7], 18);
+    w[11] ^= rotl(w[10] + w[9], 7);
+    w[8] ^= rotl(w[11] + w[10], 9);
+    w[9] ^= rotl(w[8] + w[11], 13);
+    w[10] ^= rotl(w[9] + w[8], 18);
+    w[12] ^= rotl(w[15] + w[14], 7);
+    w[13] ^= rotl(w[12] + w[15], 9);
+    w[14] ^= rotl(w[13] + w[12], 13);
+    w[15] ^= rotl(w[14] + w[13], 18);
+  }
+  for (int i = 0; i < 16; ++i)
+    b[i] += w[i];
+}
+
+// scryptBlockMix: in and out are 2r 64-byte blocks each; out holds the even
+// blocks followed by the odd ones.
+void block_mix(const std::uint32_t *in, std::uint32_t *out, unsigned r) {
+  std::uint32_t x[16];
+  std::memcpy(x, in + (2 * r - 1) * 16, sizeof x);
+  for (unsigned i = 0; i < 2 * r; ++i) {
+    salsa20_8_xor(x, in + i * 16);
+    std::memcpy(out + ((i & 1) * r + i / 2) * 16, x, sizeof x);
+  }
+}
+
+// scryptROMix over one 128r-byte chunk of B, using v (n blocks) and xy (two
+// blocks) as scratch.
+void ro_mix(unsigned char *b, unsigned r, std::uint64_t n, std::uint32_t *v,
+            std::uint32_t *xy) {
+  const std::size_t words = 32 * r;
+  std::uint32_t *x = xy;
+  std::uint32_t *y = xy + words;
+  for (std::size_t k = 0; k < words; ++k) {
+    auto p = b + 4 * k;
+    x[k] = std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8 |
+           std::uint32_t(p[2]) << 16 | std::uint32_t(p[3]) << 24;
+  }
+  for (std::uint64_t i = 0; i < n; ++i) {
+    std::memcpy(v + i * words, x, words * 4);
+    block_mix(x, y, r);
+    std::swap(x, y);
+  }
+  for (std::uint64_t i = 0; i < n; ++i) {
+    // Integerify: the first word of the last 64-byte block, mod n.
+    std::uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+    const std::uint32_t *vj = v + j * words;
+    for (std::size_t k = 0; k < words; ++k)
+      x[k] ^= vj[k];
+    block_mix(x, y, r);
+    std::swap(x, y);
+  }
+  for (std::size_t k = 0; k < words; ++k) {
+    auto p = b + 4 * k;
+    p[0] = static_cast<unsigned char>(x[k]);
+    p[1] = static_cast<unsigned char>(x[k] >> 8);
+    p[2] = static_cast<unsigned char>(x[k] >> 16);
+    p[3] = static_cast<unsigned char>(x[k] >> 24);
+  }
+}
+
+} // namespace
+
+std::string pbkdf2_sha256(std::string_view password, std::string_view salt,
+                          std::uint64_t iterations, std::size_t length) {
+  std::string out(length, '\0');
+  pbkdf2(password, salt, iterations,
+         reinterpret_cast<unsigned char *>(out.data()), length);
+  return out;
+}
+
+std::string scrypt(std::string_view password, std::string_view salt,
+                   std::uint64_t n, unsigned r, unsigned p,
+                   std::size_t length) {
+  if (n < 2 || (n & (n - 1)) || r == 0 || p == 0 ||
+      n > (std::uint64_t(1) << 32) / r)
+    throw std::invalid_argument("Invalid scrypt parameters");
+
+  const std::size_t chunk = 128 * std::size_t(r);
+  std::vector<unsigned char> b(chunk * p);
+  pbkdf2(password, salt, 1, b.data(), b.size());
+
+  // Hashing is all this pool's threads do, so keep the (large) scratch
+  // space around instead of mapping it afresh for every login.
+  thread_local std::vector<std::uint32_t> scratch;
+  std::size_t words = (n + 2) * (chunk / 4);
+  if (scratch.size() < words)
+    scratch.resize(words);
+  for (unsigned i = 0; i < p; ++i)
+    ro_mix(b.data() + i * chunk, r, n, scratch.data() + 2 * (chunk / 4),
+           scratch.data());
+
+  std::string out(length, '\0');
+  std::string_view mixed(reinterpret_cast<char *>(b.data()), b.size());
+  pbkdf2(password, mixed, 1, reinterpret_cast<unsigned char *>(out.data()),
+         length);
+  return out;
+}
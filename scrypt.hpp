@@ -0,0 +1,22 @@
+#ifndef SCRYPT_HPP
+#define SCRYPT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// The scrypt key derivation function (RFC 7914) on top of
+// PBKDF2-HMAC-SHA256. n is the CPU/memory cost and must be a power of two
+// greater than 1; each call needs 128 * r * n bytes of scratch memory, which
+// is kept per thread between calls. Throws std::invalid_argument on bad
+// parameters.
+std::string scrypt(std::string_view password, std::string_view salt,
+                   std::uint64_t n, unsigned r, unsigned p,
+                   std::size_t length);
+
+// PBKDF2 with HMAC-SHA256 as the PRF, as used inside scrypt.
+std::string pbkdf2_sha256(std::string_view password, std::string_view salt,
+                          std::uint64_t iterations, std::size_t length);
+
+#endif // SCRYPT_HPP
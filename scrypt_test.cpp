@@ -0,0 +1,79 @@
+// Holds scrypt and PBKDF2-HMAC-SHA256 to the test vectors of RFC 7914,
+// sections 11 and 12, but for the last scrypt one, which takes 1 GiB. Every
+// stored password hash depends on these matching.
+#include "scrypt.hpp"
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+std::string hex(const std::string &bytes) {
+  std::string out;
+  char digits[3];
+  for (unsigned char c : bytes) {
+    std::snprintf(digits, sizeof digits, "%02x", c);
+    out += digits;
+  }
+  return out;
+}
+
+void expect(const char *name, const std::string &key, const char *want) {
+  if (hex(key) == want)
+    return;
+  ++failures;
+  std::cerr << name << ": got " << hex(key) << "\n  want " << want << '\n';
+}
+
+void expect_invalid(std::uint64_t n, unsigned r, unsigned p) {
+  try {
+    scrypt("password", "salt", n, r, p, 32);
+  } catch (const std::invalid_argument &) {
+    return;
+  }
+  ++failures;
+  std::cerr << "scrypt took N=" << n << ", r=" << r << ", p=" << p << '\n';
+}
+
+} // namespace
+
+int main() {
+  expect("PBKDF2 passwd/salt, c=1", pbkdf2_sha256("passwd", "salt", 1, 64),
+         "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+         "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783");
+  expect("PBKDF2 Password/NaCl, c=80000",
+         pbkdf2_sha256("Password", "NaCl", 80000, 64),
+         "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+         "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d");
+
+  expect("scrypt N=16, r=1, p=1", scrypt("", "", 16, 1, 1, 64),
+         "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+         "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+  expect("scrypt N=1024, r=8, p=16",
+         scrypt("password", "NaCl", 1024, 8, 16, 64),
+         "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+         "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+  expect("scrypt N=16384, r=8, p=1",
+         scrypt("pleaseletmein", "SodiumChloride", 16384, 8, 1, 64),
+         "7023bdcb3afd7348461c06cd81fd38ebfda8fbba904f8e3ea9b543f6545da1f2"
+         "d5432955613f0fcf62d49705242a9af9e61e85dc0d651e40dfcf017b45575887");
+  // Again, on the scratch memory the call before left behind.
+  expect("scrypt N=16, r=1, p=1, repeated", scrypt("", "", 16, 1, 1, 64),
+         "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+         "fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+
+  expect_invalid(1, 8, 1);
+  expect_invalid(1000, 8, 1);
+  expect_invalid(1024, 0, 1);
+  expect_invalid(1024, 8, 0);
+
+  if (failures) {
+    std::cerr << failures << " failures\n";
+    return 1;
+  }
+  std::cout << "scrypt: checked\n";
+  return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef SERVER_CONTEXT_HPP
+#define SERVER_CONTEXT_HPP
+
+class ChatHub;
+class ContentVersions;
+class Database;
+class DbExecutor;
+class LiveDocs;
+class PasswordHasher;
+class PresenceTracker;
+class SessionStore;
+class WriteBatcher;
+
+// Long-lived services shared by every connection. Owned by main().
+struct ServerContext {
+  Database *db;
+  DbExecutor *db_executor;
+  WriteBatcher *write_batcher;
+  ChatHub *chat_hub;
+  PresenceTracker *presence;
+  SessionStore *sessions;
+  PasswordHasher *password_hasher;
+  LiveDocs *live_docs;
+  ContentVersions *versions;
+};
+
+#endif // SERVER_CONTEXT_HPP
@@ -0,0 +1,100 @@
+#include "sessions.hpp"
+#include "random.hpp"
+#include <mutex>
+
+namespace {
+
+const char hex_digits[] = "0123456789abcdef";
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+} // namespace
+
+SessionStore::SessionStore(std::time_t ttl) : ttl_(ttl) {}
+
+bool SessionStore::parse(std::string_view token, Key &key) {
+  if (token.size() != 32)
+    return false;
+  std::uint64_t halves[2] = {0, 0};
+  for (std::size_t i = 0; i < 32; ++i) {
+    int digit = hex_value(token[i]);
+    if (digit < 0)
+      return false;
+    halves[i / 16] = halves[i / 16] << 4 | static_cast<std::uint64_t>(digit);
+  }
+  key = {halves[0], halves[1]};
+  return true;
+}
+
+SessionStore::Shard &SessionStore::shard_for(const Key &key) const {
+  return shards[key.low % shard_count];
+}
+
+StoredSession SessionStore::create(const std::string &workspace,
+                                   std::time_t now) const {
+  Key key;
+  fill_random(&key, sizeof key);
+
+  StoredSession session{std::string(32, '0'), workspace, now + ttl_};
+  std::uint64_t halves[2] = {key.high, key.low};
+  for (std::size_t i = 0; i < 32; ++i)
+    session.token[i] = hex_digits[halves[i / 16] >> (60 - i % 16 * 4) & 0xf];
+  return session;
+}
+
+void SessionStore::add(const StoredSession &session) {
+  Key key;
+  if (!parse(session.token, key))
+    return;
+  auto &shard = shard_for(key);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  shard.sessions[key] = {session.workspace, session.expires};
+}
+
+bool SessionStore::find(std::string_view token, std::string &workspace,
+                        std::time_t now) const {
+  Key key;
+  if (!parse(token, key))
+    return false;
+  auto &shard = shard_for(key);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto found = shard.sessions.find(key);
+  if (found == shard.sessions.end() || found->second.expires <= now)
+    return false;
+  workspace.assign(found->second.workspace);
+  return true;
+}
+
+bool SessionStore::revoke(std::string_view token) {
+  Key key;
+  if (!parse(token, key))
+    return false;
+  auto &shard = shard_for(key);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  return shard.sessions.erase(key) > 0;
+}
+
+void SessionStore::expire(std::time_t now) {
+  for (auto &shard : shards) {
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+      if (it->second.expires <= now)
+        it = shard.sessions.erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+void SessionStore::restore(const std::vector<StoredSession> &sessions) {
+  for (const auto &session : sessions)
+    add(session);
+}
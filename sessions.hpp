@@ -0,0 +1,83 @@
+#ifndef SESSIONS_HPP
+#define SESSIONS_HPP
+
+#include "database.hpp"
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Opaque session tokens: 128 random bits, written as 32 hex digits. Every
+// live session is kept in memory so that authenticating a request is one
+// hash lookup under a shared lock; the sessions table only exists so that
+// they survive a restart.
+class SessionStore {
+public:
+  explicit SessionStore(std::time_t ttl);
+
+  SessionStore(const SessionStore &) = delete;
+  SessionStore &operator=(const SessionStore &) = delete;
+
+  // How many seconds a session lasts.
+  std::time_t ttl() const { return ttl_; }
+
+  // A new session for workspace. It is not valid until add()ed, which the
+  // caller does once it has persisted it.
+  StoredSession create(const std::string &workspace,
+                       std::time_t now = std::time(nullptr)) const;
+
+  // Make a created or restored session valid.
+  void add(const StoredSession &session);
+
+  // Copy the workspace of an unexpired session into workspace.
+  bool find(std::string_view token, std::string &workspace,
+            std::time_t now = std::time(nullptr)) const;
+
+  // End a session; false if there was none.
+  bool revoke(std::string_view token);
+
+  // Forget expired sessions. Lookups already ignore them.
+  void expire(std::time_t now = std::time(nullptr));
+
+  // Load sessions saved before a restart.
+  void restore(const std::vector<StoredSession> &sessions);
+
+private:
+  static constexpr std::size_t shard_count = 16;
+
+  struct Key {
+    std::uint64_t high, low;
+    bool operator==(const Key &other) const {
+      return high == other.high && low == other.low;
+    }
+  };
+
+  struct KeyHash {
+    // The bits are random already.
+    std::size_t operator()(const Key &key) const {
+      return static_cast<std::size_t>(key.high);
+    }
+  };
+
+  struct Entry {
+    std::string workspace;
+    std::time_t expires;
+  };
+
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<Key, Entry, KeyHash> sessions;
+  };
+
+  static bool parse(std::string_view token, Key &key);
+  Shard &shard_for(const Key &key) const;
+
+  std::time_t ttl_;
+  mutable std::array<Shard, shard_count> shards;
+};
+
+#endif // SESSIONS_HPP
@@ -0,0 +1,41 @@
+#include "statement_cache.hpp"
+#include "metrics.hpp"
+#include <stdexcept>
+#include <string>
+
+Statement::~Statement() {
+  if (stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+}
+
+StatementCache::StatementCache(sqlite3 *db) : db(db) {}
+
+StatementCache::~StatementCache() { clear(); }
+
+Statement StatementCache::prepare(const char *sql) {
+  auto it = statements.find(sql);
+  if (it != statements.end()) {
+    hit_count.fetch_add(1, std::memory_order_relaxed);
+    return Statement(it->second);
+  }
+
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt,
+                              nullptr);
+  if (rc != SQLITE_OK) {
+    metrics::record_sqlite_error(rc);
+    throw std::runtime_error("Failed to prepare statement: " +
+                             std::string(sqlite3_errmsg(db)));
+  }
+  miss_count.fetch_add(1, std::memory_order_relaxed);
+  statements.emplace(sqlite3_sql(stmt), stmt);
+  return Statement(stmt);
+}
+
+void StatementCache::clear() {
+  for (auto &entry : statements)
+    sqlite3_finalize(entry.second);
+  statements.clear();
+}
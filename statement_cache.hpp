@@ -0,0 +1,62 @@
+#ifndef STATEMENT_CACHE_HPP
+#define STATEMENT_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <sqlite3.h>
+#include <string_view>
+#include <unordered_map>
+
+// A prepared statement borrowed from a StatementCache. It converts to
+// sqlite3_stmt* for the usual sqlite3_bind_* / sqlite3_step calls and is reset,
+// with its bindings cleared, when the handle goes out of scope.
+class Statement {
+public:
+  explicit Statement(sqlite3_stmt *stmt) : stmt(stmt) {}
+  Statement(Statement &&other) noexcept : stmt(other.stmt) {
+    other.stmt = nullptr;
+  }
+  Statement(const Statement &) = delete;
+  Statement &operator=(const Statement &) = delete;
+  ~Statement();
+
+  operator sqlite3_stmt *() const { return stmt; }
+
+private:
+  sqlite3_stmt *stmt;
+};
+
+// Prepares each SQL string once per connection and hands the compiled
+// statement out again on later calls. Not thread-safe: callers must serialize
+// use of the cache together with the connection it belongs to.
+class StatementCache {
+public:
+  explicit StatementCache(sqlite3 *db);
+  ~StatementCache();
+
+  StatementCache(const StatementCache &) = delete;
+  StatementCache &operator=(const StatementCache &) = delete;
+
+  // Returns the cached statement for sql, compiling it on first use.
+  Statement prepare(const char *sql);
+
+  // Finalizes every cached statement. Must run before the connection closes.
+  void clear();
+
+  std::uint64_t hits() const {
+    return hit_count.load(std::memory_order_relaxed);
+  }
+  std::uint64_t misses() const {
+    return miss_count.load(std::memory_order_relaxed);
+  }
+
+private:
+  sqlite3 *db;
+  // Keys view the SQL text kept by SQLite (sqlite3_sql), so lookups allocate
+  // nothing.
+  std::unordered_map<std::string_view, sqlite3_stmt *> statements;
+  std::atomic<std::uint64_t> hit_count{0};
+  std::atomic<std::uint64_t> miss_count{0};
+};
+
+#endif // STATEMENT_CACHE_HPP
@@ -0,0 +1,335 @@
+// Storage benchmark for doc content. Writes the same generated corpus into a
+// database that stores content raw and into one that compresses it, then
+// reads docs back with a skewed access pattern through a deliberately small
+// page cache. Reports database size, write throughput, read latency and the
+// page cache hit rate of each. Then saves part of the corpus over and over
+// with small edits and compares the revision history kept with what keeping
+// every revision whole would take.
+#include "database.hpp"
+#include "migrations.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct BenchOptions {
+  unsigned int docs = 2000;
+  std::size_t doc_bytes = 16384; // mean content size
+  unsigned int reads = 20000;
+  double skew = 0.9;          // Zipf exponent of the read pattern
+  unsigned int cache_kb = 4096; // SQLite page cache per connection
+  unsigned int history_docs = 200;
+  unsigned int saves = 100; // per doc
+  std::uint64_t seed = 1;
+};
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --docs=N        docs in the corpus (default 2000)\n"
+               "  --doc-bytes=N   mean content size (default 16384)\n"
+               "  --reads=N       docs read back (default 20000)\n"
+               "  --skew=S        Zipf exponent of which docs are read "
+               "(default 0.9)\n"
+               "  --cache-kb=N    SQLite page cache size (default 4096)\n"
+               "  --history-docs=N  docs saved repeatedly (default 200)\n"
+               "  --saves=N       saves of each of them (default 100)\n"
+               "  --seed=N        random seed (default 1)\n";
+}
+
+BenchOptions parse_options(int argc, char *argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+      throw std::invalid_argument("Unexpected argument: " + arg);
+    auto key = arg.substr(2, eq - 2);
+    auto value = arg.substr(eq + 1);
+    if (key == "docs")
+      options.docs = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "doc-bytes")
+      options.doc_bytes = std::stoul(value);
+    else if (key == "reads")
+      options.reads = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "skew")
+      options.skew = std::stod(value);
+    else if (key == "cache-kb")
+      options.cache_kb = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "history-docs")
+      options.history_docs = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "saves")
+      options.saves = static_cast<unsigned int>(std::stoul(value));
+    else if (key == "seed")
+      options.seed = std::stoull(value);
+    else
+      throw std::invalid_argument("Unknown option: " + arg);
+  }
+  if (options.docs == 0 || options.doc_bytes == 0)
+    throw std::invalid_argument("--docs and --doc-bytes must be positive");
+  return options;
+}
+
+// Prose-like text: words drawn from a fixed vocabulary with a skew, broken
+// into lines and paragraphs, with the odd list item and heading.
+std::vector<std::string> make_corpus(const BenchOptions &options,
+                                     std::mt19937_64 &rng) {
+  const char *syllables[] = {"ka", "lo", "mi", "ne", "ta", "ri", "so", "pu",
+                             "ve", "da", "on", "el", "ar", "is", "um", "qu"};
+  std::vector<std::string> words;
+  for (int i = 0; i < 3000; ++i) {
+    std::string word;
+    for (auto n = 1 + rng() % 4; n > 0; --n)
+      word += syllables[rng() % 16];
+    words.push_back(word);
+  }
+  std::exponential_distribution<double> size(1.0 / options.doc_bytes);
+  std::vector<std::string> corpus;
+  for (unsigned int d = 0; d < options.docs; ++d) {
+    auto target = std::max<std::size_t>(64, std::lround(size(rng)));
+    std::string text;
+    while (text.size() < target) {
+      auto roll = rng() % 100;
+      if (roll < 2)
+        text += "\n\n## ";
+      else if (roll < 6)
+        text += "\n- ";
+      else if (roll < 12)
+        text += ".\n";
+      else
+        text += ' ';
+      // Squaring skews the choice towards common words.
+      auto pick = static_cast<double>(rng() % 10000) / 10000;
+      text += words[static_cast<std::size_t>(pick * pick * words.size())];
+    }
+    text.resize(target);
+    corpus.push_back(std::move(text));
+  }
+  return corpus;
+}
+
+// Doc ids to read, Zipf distributed over a shuffled ranking.
+std::vector<std::string> make_reads(const BenchOptions &options,
+                                    std::mt19937_64 &rng) {
+  std::vector<double> cdf;
+  double total = 0;
+  for (unsigned int rank = 1; rank <= options.docs; ++rank) {
+    total += 1 / std::pow(rank, options.skew);
+    cdf.push_back(total);
+  }
+  std::vector<unsigned int> ids(options.docs);
+  for (unsigned int i = 0; i < options.docs; ++i)
+    ids[i] = i + 1;
+  std::shuffle(ids.begin(), ids.end(), rng);
+  std::uniform_real_distribution<double> uniform(0, total);
+  std::vector<std::string> reads;
+  for (unsigned int i = 0; i < options.reads; ++i) {
+    auto rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) -
+                cdf.begin();
+    reads.push_back(std::to_string(ids[std::min<std::size_t>(
+        static_cast<std::size_t>(rank), ids.size() - 1)]));
+  }
+  return reads;
+}
+
+double percentile(std::vector<double> &values, double p) {
+  if (values.empty())
+    return 0;
+  auto at = static_cast<std::size_t>(p * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + at, values.end());
+  return values[at];
+}
+
+void run(const char *name, std::size_t compress_min,
+         const BenchOptions &options, const std::vector<std::string> &corpus,
+         const std::vector<std::string> &reads) {
+  char dir_template[] = "/tmp/store-bench-XXXXXX";
+  if (!mkdtemp(dir_template))
+    throw std::runtime_error("Cannot create a temporary directory");
+  std::filesystem::path dir = dir_template;
+  auto path = (dir / "bench.db").string();
+  {
+    // Everything on the writer, without mmap, so that every page read goes
+    // through the page cache being measured.
+    Database db(path, 0);
+    db.set_compress_min(compress_min);
+    migrate(db);
+    db.execute("PRAGMA mmap_size=0");
+    db.execute("PRAGMA cache_size=-" + std::to_string(options.cache_kb));
+
+    std::size_t bytes = 0;
+    auto started = clock_type::now();
+    db.execute("BEGIN");
+    for (const auto &content : corpus) {
+      db.insert_doc("bench", "2024-01-01", "doc", content);
+      bytes += content.size();
+    }
+    db.execute("COMMIT");
+    auto write_time =
+        std::chrono::duration<double>(clock_type::now() - started).count();
+    db.execute("PRAGMA wal_checkpoint(TRUNCATE)");
+    auto size = std::filesystem::file_size(path);
+
+    auto hits = db.page_cache_hits();
+    auto misses = db.page_cache_misses();
+    std::vector<double> latencies;
+    std::size_t read_bytes = 0;
+    for (const auto &id : reads) {
+      auto begin = clock_type::now();
+      db.get_doc_by_id("bench", id,
+                       [&](std::string_view, std::string_view content,
+                           std::int64_t) { read_bytes += content.size(); });
+      latencies.push_back(
+          std::chrono::duration<double, std::micro>(clock_type::now() - begin)
+              .count());
+    }
+    hits = db.page_cache_hits() - hits;
+    misses = db.page_cache_misses() - misses;
+
+    std::printf("%-11s %9.2f %7.3f %9.1f %9.1f %9.1f %9.1f %8.1f%%\n", name,
+                size / 1048576.0, static_cast<double>(size) / bytes,
+                bytes / 1048576.0 / write_time, percentile(latencies, 0.5),
+                percentile(latencies, 0.99), percentile(latencies, 0.999),
+                hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    if (read_bytes == 0 && !reads.empty())
+      throw std::runtime_error("Read back nothing");
+  }
+  std::filesystem::remove_all(dir);
+}
+
+// Save each of the first history_docs docs saves times, alternately
+// replacing it whole and patching it, each save a burst of typing somewhere
+// in the doc and now and then a deletion.
+void run_history(const BenchOptions &options,
+                 const std::vector<std::string> &corpus,
+                 std::mt19937_64 &rng) {
+  char dir_template[] = "/tmp/store-bench-XXXXXX";
+  if (!mkdtemp(dir_template))
+    throw std::runtime_error("Cannot create a temporary directory");
+  std::filesystem::path dir = dir_template;
+  {
+    Database db((dir / "bench.db").string(), 0);
+    migrate(db);
+    std::vector<std::string> texts(
+        corpus.begin(),
+        corpus.begin() + std::min<std::size_t>(options.history_docs,
+                                               corpus.size()));
+    std::size_t full = 0; // bytes of every revision whole
+    auto started = clock_type::now();
+    db.execute("BEGIN");
+    for (const auto &text : texts) {
+      db.insert_doc("bench", "2024-01-01", "doc", text);
+      full += text.size();
+    }
+    for (unsigned int save = 0; save < options.saves; ++save) {
+      for (std::size_t d = 0; d < texts.size(); ++d) {
+        auto &text = texts[d];
+        auto at = std::uniform_int_distribution<std::size_t>(
+            0, text.size())(rng);
+        std::size_t erase = 0;
+        if (rng() % 5 == 0)
+          erase = std::min<std::size_t>(text.size() - at, rng() % 40);
+        std::string typed;
+        for (auto n = rng() % 40 + 1; n > 0; --n)
+          typed += static_cast<char>('a' + rng() % 26);
+        auto id = std::to_string(d + 1);
+        if (save % 2) {
+          std::vector<DocOp> ops = {{at, erase, typed}};
+          std::int64_t revision = 0;
+          if (db.edit_doc("bench", id, save, ops, revision) !=
+              DocEdit::applied)
+            throw std::runtime_error("Edit of doc " + id + " failed");
+          text.replace(at, erase, typed);
+        } else {
+          text.replace(at, erase, typed);
+          db.update_doc("bench", id, "doc", text);
+        }
+        full += text.size();
+      }
+    }
+    db.execute("COMMIT");
+    auto write_time =
+        std::chrono::duration<double>(clock_type::now() - started).count();
+
+    auto revisions = db.query_int64("SELECT COUNT(*) FROM doc_revisions");
+    auto keyframes =
+        db.query_int64("SELECT COUNT(*) FROM doc_revisions WHERE depth = 0");
+    auto stored = static_cast<std::size_t>(
+        db.query_int64("SELECT SUM(length(data)) FROM doc_revisions"));
+
+    std::vector<double> latencies;
+    std::string content;
+    for (unsigned int i = 0; i < options.reads && !texts.empty(); ++i) {
+      auto id = std::to_string(rng() % texts.size() + 1);
+      auto revision = static_cast<std::int64_t>(rng() % (options.saves + 1));
+      std::int64_t time = 0;
+      auto begin = clock_type::now();
+      if (!db.get_doc_revision("bench", id, revision, content, time))
+        throw std::runtime_error("Revision " + std::to_string(revision) +
+                                 " of doc " + id + " is missing");
+      latencies.push_back(
+          std::chrono::duration<double, std::micro>(clock_type::now() - begin)
+              .count());
+    }
+
+    std::printf("\n%zu docs saved %u times each, %.1f saves/s\n",
+                texts.size(), options.saves,
+                texts.size() * options.saves / write_time);
+    std::printf("revisions  %10lld, %lld of them keyframes\n",
+                static_cast<long long>(revisions),
+                static_cast<long long>(keyframes));
+    std::printf("history    %10.2f MiB, against %.2f MiB as full copies "
+                "(%.2f%%)\n",
+                stored / 1048576.0, full / 1048576.0,
+                full ? 100.0 * stored / full : 0.0);
+    std::printf("fetch      p50 %.1f us, p99 %.1f us, p999 %.1f us\n",
+                percentile(latencies, 0.5), percentile(latencies, 0.99),
+                percentile(latencies, 0.999));
+  }
+  std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchOptions options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    std::mt19937_64 rng(options.seed);
+    auto corpus = make_corpus(options, rng);
+    auto reads = make_reads(options, rng);
+    std::printf("%u docs of %zu bytes on average, %u reads, %u KiB page "
+                "cache\n",
+                options.docs, options.doc_bytes, options.reads,
+                options.cache_kb);
+    std::printf("%-11s %9s %7s %9s %9s %9s %9s %9s\n", "content", "db MiB",
+                "ratio", "write MB/s", "read p50", "p99 us", "p999 us",
+                "cache hit");
+    run("raw", 0, options, corpus, reads);
+    run("compressed", Database::default_compress_min, options, corpus, reads);
+    if (options.history_docs && options.saves)
+      run_history(options, corpus, rng);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+#include "versions.hpp"
+#include "random.hpp"
+#include <cstdio>
+#include <functional>
+
+ContentVersions::ContentVersions() { fill_random(&epoch, sizeof epoch); }
+
+std::string ContentVersions::doc_etag(std::int64_t id) const {
+  return etag(docs, std::hash<std::int64_t>{}(id));
+}
+
+std::string ContentVersions::chat_etag(std::string_view workspace) const {
+  return etag(chats, std::hash<std::string_view>{}(workspace));
+}
+
+void ContentVersions::bump_doc(std::int64_t id) {
+  docs[std::hash<std::int64_t>{}(id) % slot_count].fetch_add(
+      1, std::memory_order_release);
+}
+
+void ContentVersions::bump_chat(std::string_view workspace) {
+  chats[std::hash<std::string_view>{}(workspace) % slot_count].fetch_add(
+      1, std::memory_order_release);
+}
+
+bool ContentVersions::matches(std::string_view if_none_match,
+                              std::string_view etag) {
+  while (!if_none_match.empty()) {
+    auto comma = if_none_match.find(',');
+    auto tag = if_none_match.substr(0, comma);
+    while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+      tag.remove_prefix(1);
+    while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+      tag.remove_suffix(1);
+    if (tag.substr(0, 2) == "W/")
+      tag.remove_prefix(2);
+    if (tag == etag)
+      return true;
+    if (comma == std::string_view::npos)
+      break;
+    if_none_match.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+std::string ContentVersions::etag(const Slots &slots, std::size_t hash) const {
+  // The full hash is in the tag as well, so that a tag of one id is not
+  // taken for another's that shares its slot.
+  auto version = slots[hash % slot_count].load(std::memory_order_acquire);
+  char buffer[64];
+  std::snprintf(buffer, sizeof buffer, "\"%llx-%zx-%llx\"",
+                static_cast<unsigned long long>(epoch), hash,
+                static_cast<unsigned long long>(version));
+  return buffer;
+}
@@ -0,0 +1,52 @@
+#ifndef VERSIONS_HPP
+#define VERSIONS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Version counters that conditional GETs are answered from, kept in memory:
+// one for each doc and one for each workspace's chat, bumped once a write to
+// it has committed. A response tagged with a counter's value is current for
+// as long as the counter stays there, so a poll that sends the tag back can
+// be answered 304 without a query.
+//
+// Ids share a fixed table of counters by hash. A bump can expire the tags of
+// other ids in its slot too, which costs their clients a full response but
+// never leaves them with a stale one.
+class ContentVersions {
+public:
+  ContentVersions();
+
+  ContentVersions(const ContentVersions &) = delete;
+  ContentVersions &operator=(const ContentVersions &) = delete;
+
+  // ETag of the current version of doc id, or of workspace's chat. Taken
+  // before reading what it tags, so that a write committed in between only
+  // makes the tag look older than the response.
+  std::string doc_etag(std::int64_t id) const;
+  std::string chat_etag(std::string_view workspace) const;
+
+  void bump_doc(std::int64_t id);
+  void bump_chat(std::string_view workspace);
+
+  // Whether an If-None-Match value lists etag. Tags compare weakly, as
+  // RFC 9110 has it for GET.
+  static bool matches(std::string_view if_none_match, std::string_view etag);
+
+private:
+  static constexpr std::size_t slot_count = 4096;
+  using Slots = std::array<std::atomic<std::uint64_t>, slot_count>;
+
+  std::string etag(const Slots &slots, std::size_t hash) const;
+
+  // Random, so that tags handed out before a restart never match.
+  std::uint64_t epoch;
+  Slots docs{};
+  Slots chats{};
+};
+
+#endif // VERSIONS_HPP
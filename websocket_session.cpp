@@ -0,0 +1,54 @@
+#include "websocket_session.hpp"
+
+websocket_session::websocket_session(tcp::socket socket, ChatHub *hub,
+                                     std::string workspace)
+    : ws_(std::move(socket)), hub_(hub), workspace_(std::move(workspace)) {}
+
+websocket_session::~websocket_session() { hub_->leave(workspace_, this); }
+
+void websocket_session::on_accept(beast::error_code ec) {
+  if (ec)
+    return;
+  ws_.set_option(
+      websocket::stream_base::timeout::suggested(beast::role_type::server));
+  hub_->join(workspace_, shared_from_this());
+  read();
+}
+
+void websocket_session::read() {
+  auto self = shared_from_this();
+  ws_.async_read(buffer_, [self](beast::error_code ec, std::size_t) {
+    if (ec)
+      return; // closed; the hub forgets us when the last reference goes
+    self->buffer_.consume(self->buffer_.size());
+    self->read();
+  });
+}
+
+void websocket_session::send(std::shared_ptr<const std::string> message) {
+  auto self = shared_from_this();
+  net::post(ws_.get_executor(), [self, message = std::move(message)] {
+    if (self->queue_.size() >= max_queue) {
+      // Closing makes the pending read fail, which releases the session.
+      beast::error_code ec;
+      beast::get_lowest_layer(self->ws_).close(ec);
+      return;
+    }
+    self->queue_.push_back(message);
+    if (self->queue_.size() == 1)
+      self->write();
+  });
+}
+
+void websocket_session::write() {
+  auto self = shared_from_this();
+  ws_.text(true);
+  ws_.async_write(net::buffer(*queue_.front()),
+                  [self](beast::error_code ec, std::size_t) {
+                    if (ec)
+                      return;
+                    self->queue_.pop_front();
+                    if (!self->queue_.empty())
+                      self->write();
+                  });
+}
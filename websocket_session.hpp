@@ -0,0 +1,53 @@
+#ifndef WEBSOCKET_SESSION_HPP
+#define WEBSOCKET_SESSION_HPP
+
+#include "chat_hub.hpp"
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <boost/beast/websocket.hpp>
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+
+// A WebSocket subscriber to one workspace's chat. The server only pushes
+// messages; anything the client sends is read and discarded so that pings and
+// close frames are still handled.
+class websocket_session
+    : public std::enable_shared_from_this<websocket_session> {
+public:
+  websocket_session(tcp::socket socket, ChatHub *hub, std::string workspace);
+  ~websocket_session();
+
+  // Complete the WebSocket handshake answering req, then join the hub.
+  template <class Body, class Allocator>
+  void start(http::request<Body, http::basic_fields<Allocator>> req) {
+    auto self = shared_from_this();
+    ws_.async_accept(req,
+                     [self](beast::error_code ec) { self->on_accept(ec); });
+  }
+
+  // Queue a text frame. Safe to call from any thread.
+  void send(std::shared_ptr<const std::string> message);
+
+private:
+  // A subscriber this far behind is dropped instead of buffering forever.
+  static constexpr std::size_t max_queue = 1024;
+
+  websocket::stream<tcp::socket> ws_;
+  ChatHub *hub_;
+  std::string workspace_;
+  beast::flat_buffer buffer_;
+  std::deque<std::shared_ptr<const std::string>> queue_;
+
+  void on_accept(beast::error_code ec);
+  void read();
+  void write();
+};
+
+#endif // WEBSOCKET_SESSION_HPP
@@ -0,0 +1,82 @@
+#include "write_batcher.hpp"
+#include "database.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+WriteBatcher::WriteBatcher(Database &db, std::chrono::milliseconds window,
+                           std::size_t max_batch)
+    : db(db), window(window), max_batch(std::max<std::size_t>(max_batch, 1)),
+      worker([this] { run(); }) {}
+
+WriteBatcher::~WriteBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_one();
+  worker.join();
+}
+
+void WriteBatcher::submit(Job job) {
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.empty())
+      oldest = std::chrono::steady_clock::now();
+    pending.push_back(std::move(job));
+    // The worker only needs a nudge to start a window or to cut one short.
+    wake = pending.size() == 1 || pending.size() == max_batch;
+  }
+  if (wake)
+    ready.notify_one();
+}
+
+void WriteBatcher::run() {
+  std::deque<Job> batch;
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    ready.wait(lock, [this] { return stopping || !pending.empty(); });
+    if (pending.empty())
+      return; // stopping, and everything submitted has been committed
+
+    // Let concurrent writers join until the window closes or the batch is
+    // full.
+    ready.wait_until(lock, oldest + window, [this] {
+      return stopping || pending.size() >= max_batch;
+    });
+
+    std::size_t count = std::min(pending.size(), max_batch);
+    std::move(pending.begin(), pending.begin() + count,
+              std::back_inserter(batch));
+    pending.erase(pending.begin(), pending.begin() + count);
+    // Whatever is left has already waited a full window.
+    oldest = std::chrono::steady_clock::now() - window;
+
+    lock.unlock();
+    commit(batch);
+    batch.clear();
+    lock.lock();
+  }
+}
+
+void WriteBatcher::commit(std::deque<Job> &batch) {
+  std::vector<std::function<void()>> jobs;
+  jobs.reserve(batch.size());
+  for (auto &job : batch)
+    jobs.push_back(std::move(job.run));
+
+  std::vector<std::exception_ptr> errors;
+  try {
+    errors = db.write_batch(jobs);
+  } catch (...) {
+    // The transaction did not commit, so none of the jobs took effect.
+    errors.assign(batch.size(), std::current_exception());
+  }
+  metrics::increment(metrics::Counter::write_batches);
+  metrics::increment(metrics::Counter::batched_writes, batch.size());
+
+  for (std::size_t i = 0; i < batch.size(); ++i)
+    batch[i].done(errors[i]);
+}
@@ -0,0 +1,74 @@
+#ifndef WRITE_BATCHER_HPP
+#define WRITE_BATCHER_HPP
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace net = boost::asio;
+
+class Database;
+
+// Group commit for writes. Jobs that arrive within a short window of each
+// other run on one thread inside a single write transaction, so the whole
+// batch pays for one journal sync instead of one per request. Each job only
+// completes once the transaction holding it has committed.
+class WriteBatcher {
+public:
+  // A batch is committed window after its first job arrived, or as soon as
+  // max_batch jobs are waiting, whichever comes first.
+  WriteBatcher(Database &db, std::chrono::milliseconds window,
+               std::size_t max_batch);
+  ~WriteBatcher();
+
+  WriteBatcher(const WriteBatcher &) = delete;
+  WriteBatcher &operator=(const WriteBatcher &) = delete;
+
+  // Run fn inside the next batch, then complete with void(std::exception_ptr)
+  // on the executor associated with token, after the commit. fn gets its own
+  // savepoint: if it throws, only its changes are rolled back.
+  template <class Function, class CompletionToken>
+  auto async_run(Function fn, CompletionToken &&token) {
+    return net::async_initiate<CompletionToken, void(std::exception_ptr)>(
+        [this](auto handler, Function fn) {
+          // std::function needs a copyable target.
+          auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+          submit({std::move(fn), [shared](std::exception_ptr error) {
+                    auto ex = net::get_associated_executor(*shared);
+                    net::post(ex, [shared, error] { (*shared)(error); });
+                  }});
+        },
+        token, std::move(fn));
+  }
+
+private:
+  struct Job {
+    std::function<void()> run;
+    std::function<void(std::exception_ptr)> done;
+  };
+
+  void submit(Job job);
+  void run();
+  void commit(std::deque<Job> &batch);
+
+  Database &db;
+  const std::chrono::milliseconds window;
+  const std::size_t max_batch;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Job> pending;
+  std::chrono::steady_clock::time_point oldest; // arrival of pending.front()
+  bool stopping = false;
+  std::thread worker;
+};
+
+#endif // WRITE_BATCHER_HPP